@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+
+# Generate a perfect hash table from a file of "<name> <value>" lines.
+# The table is indexed by anthywl_name_hash(name, seed) masked to the table
+# size, and is meant to be looked up with anthywl_name_lookup. With
+# --by-value, a <table>_by_value array mapping each value back to the first
+# name given for it is written too; values must then be array indices.
+
+import os
+import sys
+
+def name_hash(name, seed):
+    h = (2166136261 ^ seed) & 0xffffffff
+    for c in name.encode():
+        h ^= c
+        h = (h * 16777619) & 0xffffffff
+    return h
+
+def find_seed(names, size):
+    for seed in range(1 << 14):
+        slots = set()
+        for name in names:
+            slot = name_hash(name, seed) & (size - 1)
+            if slot in slots:
+                break
+            slots.add(slot)
+        else:
+            return seed
+    return None
+
+def perfect_hash(infilename, infile, outfile, table, by_value):
+    entries = []
+    for lineno, line in enumerate(infile, 1):
+        line = line.split('#', 1)[0].strip()
+        if not line:
+            continue
+        fields = line.split()
+        if len(fields) != 2:
+            sys.exit('%s:%d: expected a name and a value' % (infilename, lineno))
+        entries.append(fields)
+
+    names = [name for name, value in entries]
+    if len(set(names)) != len(names):
+        sys.exit('%s: duplicate names' % infilename)
+
+    size = 1
+    while size < len(entries):
+        size *= 2
+    while True:
+        seed = find_seed(names, size)
+        if seed is not None:
+            break
+        size *= 2
+
+    slots = [None] * size
+    for name, value in entries:
+        slots[name_hash(name, seed) & (size - 1)] = (name, value)
+
+    outfile.write('// Generated from %s\n\n' % os.path.basename(infilename))
+    outfile.write('static uint32_t const %s_seed = %d;\n\n' % (table, seed))
+    outfile.write('static struct anthywl_name const %s[%d] = {\n' % (table, size))
+    for slot, entry in enumerate(slots):
+        if entry is not None:
+            outfile.write('    [%d] = { "%s", %s },\n' % (slot, entry[0], entry[1]))
+    outfile.write('};\n')
+
+    if by_value:
+        outfile.write('\nstatic char const *const %s_by_value[] = {\n' % table)
+        seen = set()
+        for name, value in entries:
+            if value not in seen:
+                seen.add(value)
+                outfile.write('    [%s] = "%s",\n' % (value, name))
+        outfile.write('};\n')
+
+if __name__ == '__main__':
+    args = sys.argv[1:]
+    by_value = '--by-value' in args
+    if by_value:
+        args.remove('--by-value')
+    if len(args) != 3:
+        sys.exit('usage: %s [--by-value] <table name> <input> <output>'
+            % sys.argv[0])
+
+    with open(args[1]) as infile, open(args[2], 'w') as outfile:
+        perfect_hash(args[1], infile, outfile, args[0], by_value)
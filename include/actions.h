@@ -2,7 +2,7 @@
 
 #include <stdbool.h>
 
-struct anthywl_seat;
+struct anthywl_composer;
 
 enum anthywl_action {
     ANTHYWL_ACTION_INVALID,
@@ -26,9 +26,11 @@ enum anthywl_action {
     ANTHYWL_ACTION_SELECT_KATAKANA_CANDIDATE,
     ANTHYWL_ACTION_SELECT_HIRAGANA_CANDIDATE,
     ANTHYWL_ACTION_SELECT_HALFKANA_CANDIDATE,
+    ANTHYWL_ACTION_RECONVERT,
     _ANTHYWL_ACTION_LAST,
 };
 
 enum anthywl_action anthywl_action_from_string(const char *name);
-bool anthywl_seat_handle_action(struct anthywl_seat *seat,
+char const *anthywl_action_to_string(enum anthywl_action action);
+bool anthywl_composer_handle_action(struct anthywl_composer *composer,
     enum anthywl_action action);
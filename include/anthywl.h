@@ -1,73 +1,87 @@
 #pragma once
 
 #include <anthy/anthy.h>
+#include <pango/pango.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <wayland-client-core.h>
 #include <xkbcommon/xkbcommon.h>
 
+#include "cursor-shape-v1-client-protocol.h"
 #include "input-method-unstable-v2-client-protocol.h"
 #include "text-input-unstable-v3-client-protocol.h"
 #include "virtual-keyboard-unstable-v1-client-protocol.h"
 
 #include "actions.h"
+#include "arena.h"
+#include "bindings.h"
 #include "buffer.h"
+#include "composer.h"
 #include "config.h"
+#include "event_loop.h"
+#include "keymap.h"
+#include "metrics.h"
+#include "record.h"
+#include "sink.h"
+#include "timer.h"
+#include "trace.h"
 
 #ifdef ANTHYWL_IPC_SUPPORT
 #include "ipc.h"
 #include <varlink.h>
 #endif
 
-enum anthyl_modifier_index {
-    ANTHYWL_SHIFT_INDEX,
-    ANTHYWL_CAPS_INDEX,
-    ANTHYWL_CTRL_INDEX,
-    ANTHYWL_ALT_INDEX,
-    ANTHYWL_NUM_INDEX,
-    ANTHYWL_MOD3_INDEX,
-    ANTHYWL_LOGO_INDEX,
-    ANTHYWL_MOD5_INDEX,
-    _ANTHYWL_MOD_LAST,
-};
-
-enum anthywl_modifier {
-    ANTHYWL_SHIFT = 1 << ANTHYWL_SHIFT_INDEX,
-    ANTHYWL_CAPS = 1 << ANTHYWL_CAPS_INDEX,
-    ANTHYWL_CTRL = 1 << ANTHYWL_CTRL_INDEX,
-    ANTHYWL_ALT = 1 << ANTHYWL_ALT_INDEX,
-    ANTHYWL_NUM = 1 << ANTHYWL_NUM_INDEX,
-    ANTHYWL_MOD3 = 1 << ANTHYWL_MOD3_INDEX,
-    ANTHYWL_LOGO = 1 << ANTHYWL_LOGO_INDEX,
-    ANTHYWL_MOD5 = 1 << ANTHYWL_MOD5_INDEX,
-};
-
 struct anthywl_state {
     bool running;
+    struct anthywl_event_loop event_loop;
+    struct anthywl_event_source display_source;
+    struct anthywl_event_source timer_source;
+    struct anthywl_signal_source signal_source;
+    struct anthywl_event_source config_source;
+    struct anthywl_timer config_reload_timer;
     struct wl_display *wl_display;
     struct wl_registry *wl_registry;
     struct wl_compositor *wl_compositor;
     struct wl_shm *wl_shm;
     struct zwp_input_method_manager_v2 *zwp_input_method_manager_v2;
     struct zwp_virtual_keyboard_manager_v1 *zwp_virtual_keyboard_manager_v1;
+    struct wp_cursor_shape_manager_v1 *wp_cursor_shape_manager_v1;
     struct wl_cursor_theme *wl_cursor_theme;
     int wl_cursor_theme_size;
     int wl_cursor_theme_scale;
     struct wl_list buffers;
     struct wl_list seats;
     struct wl_list outputs;
-    struct wl_list timers;
+    struct xkb_context *xkb_context;
+    // struct anthywl_keymap, most recently used first.
+    struct wl_list keymaps;
+    struct anthywl_timer_queue timers;
     struct anthywl_config config;
+    int batch_depth;
+    struct anthywl_recorder recorder;
 #ifdef ANTHYWL_IPC_SUPPORT
     struct anthywl_ipc ipc;
 #endif
     int max_scale;
 };
 
-struct anthywl_timer {
+// A compiled keymap and everything derived from it, shared by all seats
+// whose keyboard grab sent the same keymap.
+struct anthywl_keymap {
     struct wl_list link;
-    struct timespec time;
-    void (*callback)(struct anthywl_timer *timer);
+    struct anthywl_state *state;
+    int refcount;
+    uint64_t hash;
+    char *string;
+    size_t size;
+    struct xkb_keymap *xkb_keymap;
+    xkb_mod_index_t mod_indices[_ANTHYWL_MOD_LAST];
+    xkb_mod_mask_t binding_mods;
+    // struct anthywl_keysym_keycode, sorted by keysym.
+    struct anthywl_array keysym_keycodes;
+    struct anthywl_seat_bindings global_bindings;
+    struct anthywl_seat_bindings composing_bindings;
+    struct anthywl_seat_bindings selecting_bindings;
 };
 
 struct anthywl_output {
@@ -80,7 +94,12 @@ struct anthywl_output {
 struct anthywl_seat {
     struct wl_list link;
     struct anthywl_state *state;
+    // What the seat is composing, and where its requests go.
+    struct anthywl_composer composer;
+    // NULL when replaying a recording.
     struct wl_seat *wl_seat;
+    // Tells this seat's events apart from other seats' in a recording.
+    uint32_t record_index;
 
     bool are_protocols_initted;
     struct zwp_input_method_v2 *zwp_input_method_v2;
@@ -91,17 +110,13 @@ struct anthywl_seat {
     // wl_pointer
     struct wl_pointer *wl_pointer;
     uint32_t wl_pointer_serial;
+    struct wp_cursor_shape_device_v1 *wp_cursor_shape_device_v1;
     struct wl_surface *wl_surface_cursor;
     struct anthywl_timer cursor_timer;
 
-    char *xkb_keymap_string;
-    struct xkb_context *xkb_context;
-    struct xkb_keymap *xkb_keymap;
+    struct anthywl_keymap *keymap;
     struct xkb_state *xkb_state;
-    xkb_mod_index_t mod_indices[_ANTHYWL_MOD_LAST];
-    struct wl_array global_bindings;
-    struct wl_array composing_bindings;
-    struct wl_array selecting_bindings;
+    xkb_mod_mask_t active_binding_mods;
 
     // wl_seat
     char *name;
@@ -111,14 +126,14 @@ struct anthywl_seat {
     int scale;
 
     // zwp_input_method_v2
-    bool pending_activate, active;
-    char *pending_surrounding_text, *surrounding_text;
-    uint32_t pending_surrounding_text_cursor, surrounding_text_cursor;
-    uint32_t pending_surrounding_text_anchor, surrounding_text_anchor;
+    bool pending_activate;
+    struct anthywl_surrounding_text pending_surrounding_text;
     uint32_t pending_text_change_cause, text_change_cause;
     uint32_t pending_content_type_hint, content_type_hint;
     uint32_t pending_content_type_purpose, content_type_purpose;
     uint32_t done_events_received;
+    // Whether composing was enabled before a content type forced a mode.
+    bool default_is_composing;
 
     // zwp_input_method_keyboard_grab_v2
     uint32_t repeat_rate;
@@ -126,40 +141,21 @@ struct anthywl_seat {
     xkb_keycode_t pressed[64];
     xkb_keycode_t repeating_keycode;
     uint32_t repeating_timestamp;
+    uint64_t repeat_start;
+    uint64_t repeat_count;
     struct anthywl_timer repeat_timer;
 
-    // popup
-    struct anthywl_buffer buffer;
-
-    // composing
-    bool is_composing;
-    bool is_composing_popup_visible;
-
-    // selecting
-    bool is_selecting;
-    bool is_selecting_popup_visible;
-    int current_segment;
-    int segment_count;
-    int *selected_candidates;
-    anthy_context_t anthy_context;
+    // zwp_virtual_keyboard_v1_backup_input
+    struct anthywl_fallback_keymap fallback_keymap;
+    struct anthywl_array fallback_keys;
 
     // popup
+    PangoContext *pango_context;
+    PangoLayout *pango_layout;
     struct wl_surface *wl_surface;
     struct zwp_input_popup_surface_v2 *zwp_input_popup_surface_v2;
 };
 
-struct anthywl_binding {
-    xkb_keysym_t keysym;
-    enum anthywl_modifier modifiers;
-    enum anthywl_action action;
-};
-
-struct anthywl_seat_binding {
-    xkb_keycode_t keycode;
-    xkb_mod_mask_t mod_mask;
-    enum anthywl_action action;
-};
-
 void zwp_input_popup_surface_v2_text_input_rectangle(void *data,
     struct zwp_input_popup_surface_v2 *zwp_input_popup_surface_v2,
     int32_t x, int32_t y, int32_t width, int32_t height);
@@ -251,27 +247,37 @@ void anthywl_seat_init(struct anthywl_seat *seat,
     struct anthywl_state *state, struct wl_seat *wl_seat);
 void anthywl_seat_init_protocols(struct anthywl_seat *seat);
 void anthywl_seat_destroy(struct anthywl_seat *seat);
-void anthywl_seat_composing_update(struct anthywl_seat *seat);
-void anthywl_seat_composing_commit(struct anthywl_seat *seat);
-void anthywl_seat_selecting_update(struct anthywl_seat *seat);
-void anthywl_seat_selecting_commit(struct anthywl_seat *seat);
-int anthywl_binding_compare(void const *_a, void const *_b);
-int anthywl_seat_binding_compare(void const *_a, void const *_b);
-int anthywl_seat_binding_compare_without_action(
-    void const *_a, void const *_b);
+bool anthywl_seat_type_string(struct anthywl_seat *seat, char const *text);
 bool anthywl_seat_handle_key_bindings(struct anthywl_seat *seat,
-    struct wl_array *bindings, struct anthywl_seat_binding *press);
+    struct anthywl_seat_bindings *bindings,
+    xkb_keycode_t keycode, xkb_mod_mask_t mod_mask);
 bool anthywl_seat_handle_key(struct anthywl_seat *seat, xkb_keycode_t keycode);
 void anthywl_seat_repeat_timer_callback(struct anthywl_timer *timer);
-void anthywl_seat_set_up_bindings(struct anthywl_seat *seat,
-    struct wl_array *state_bindings, struct wl_array *seat_bindings);
+void anthywl_seat_apply_content_type(struct anthywl_seat *seat);
 void anthywl_seat_cursor_update(struct anthywl_seat *seat);
 void anthywl_seat_cursor_timer_callback(struct anthywl_timer *timer);
 
+void anthywl_keymap_rebuild_bindings(struct anthywl_keymap *keymap,
+    enum anthywl_config_change changes);
+struct anthywl_keymap *anthywl_keymap_get(struct anthywl_state *state,
+    char const *string, size_t size);
+void anthywl_keymap_unref(struct anthywl_keymap *keymap);
+void anthywl_keymap_destroy(struct anthywl_keymap *keymap);
+
 void anthywl_reload_cursor_theme(struct anthywl_state *state);
+bool anthywl_state_init_headless(struct anthywl_state *state);
 bool anthywl_state_init(struct anthywl_state *state);
-int anthywl_state_next_timer(struct anthywl_state *state);
-void anthywl_state_run_timers(struct anthywl_state *state);
+void anthywl_state_begin_batch(struct anthywl_state *state);
+void anthywl_state_end_batch(struct anthywl_state *state);
+void anthywl_state_handle_display(struct anthywl_event_source *source,
+    uint32_t events);
+void anthywl_state_handle_timers(struct anthywl_event_source *source,
+    uint32_t events);
+void anthywl_state_handle_signal(struct anthywl_signal_source *source,
+    int signal);
+void anthywl_state_handle_config_changed(struct anthywl_event_source *source,
+    uint32_t events);
+void anthywl_state_reload_config_timer_callback(struct anthywl_timer *timer);
 void anthywl_state_run(struct anthywl_state *state);
 void anthywl_state_finish(struct anthywl_state *state);
 
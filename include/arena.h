@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct anthywl_arena_block;
+
+// Scratch memory for strings that only live until the end of the current
+// event batch. Once the arena has grown to what a batch needs, allocating
+// from it never touches the heap.
+struct anthywl_arena {
+    char *data;
+    size_t len, cap;
+    // Allocations that didn't fit in data, freed on the next reset.
+    struct anthywl_arena_block *overflow;
+    size_t overflow_size;
+};
+
+// Number of heap allocations made for the arenas and preedit buffers. Other
+// allocations, such as Pango's and cairo's, aren't counted.
+extern uint64_t anthywl_scratch_allocations;
+
+void anthywl_arena_init(struct anthywl_arena *arena);
+void anthywl_arena_finish(struct anthywl_arena *arena);
+void anthywl_arena_reset(struct anthywl_arena *arena);
+void *anthywl_arena_alloc(struct anthywl_arena *arena, size_t size);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+
+// A growable array of same-sized elements, with sizes in bytes. It works
+// like wl_array, for code that doesn't otherwise need Wayland.
+struct anthywl_array {
+    void *data;
+    size_t size, alloc;
+};
+
+#define anthywl_array_for_each(pos, array) \
+    for (pos = (array)->data; \
+        (char const *)pos < (char const *)(array)->data + (array)->size; \
+        pos++)
+
+void anthywl_array_init(struct anthywl_array *array);
+void anthywl_array_release(struct anthywl_array *array);
+// Returns room for size more bytes at the end, or NULL if out of memory.
+void *anthywl_array_add(struct anthywl_array *array, size_t size);
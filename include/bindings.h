@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <xkbcommon/xkbcommon.h>
+
+#include "actions.h"
+#include "array.h"
+
+enum anthyl_modifier_index {
+    ANTHYWL_SHIFT_INDEX,
+    ANTHYWL_CAPS_INDEX,
+    ANTHYWL_CTRL_INDEX,
+    ANTHYWL_ALT_INDEX,
+    ANTHYWL_NUM_INDEX,
+    ANTHYWL_MOD3_INDEX,
+    ANTHYWL_LOGO_INDEX,
+    ANTHYWL_MOD5_INDEX,
+    _ANTHYWL_MOD_LAST,
+};
+
+enum anthywl_modifier {
+    ANTHYWL_SHIFT = 1 << ANTHYWL_SHIFT_INDEX,
+    ANTHYWL_CAPS = 1 << ANTHYWL_CAPS_INDEX,
+    ANTHYWL_CTRL = 1 << ANTHYWL_CTRL_INDEX,
+    ANTHYWL_ALT = 1 << ANTHYWL_ALT_INDEX,
+    ANTHYWL_NUM = 1 << ANTHYWL_NUM_INDEX,
+    ANTHYWL_MOD3 = 1 << ANTHYWL_MOD3_INDEX,
+    ANTHYWL_LOGO = 1 << ANTHYWL_LOGO_INDEX,
+    ANTHYWL_MOD5 = 1 << ANTHYWL_MOD5_INDEX,
+};
+
+// A binding as written in the config file.
+struct anthywl_binding {
+    xkb_keysym_t keysym;
+    enum anthywl_modifier modifiers;
+    enum anthywl_action action;
+};
+
+struct anthywl_keysym_keycode {
+    xkb_keysym_t keysym;
+    xkb_keycode_t keycode;
+};
+
+// A binding resolved against a keymap.
+struct anthywl_seat_binding {
+    xkb_keycode_t keycode;
+    xkb_mod_mask_t mod_mask;
+    enum anthywl_action action;
+};
+
+struct anthywl_seat_bindings {
+    // struct anthywl_seat_binding, sorted by keycode and modifiers.
+    struct anthywl_array bindings;
+    // The bindings for a keycode k are those in [starts[k], starts[k + 1]).
+    uint32_t *starts;
+    xkb_keycode_t max_keycode;
+};
+
+int anthywl_binding_compare(void const *_a, void const *_b);
+int anthywl_seat_binding_compare(void const *_a, void const *_b);
+int anthywl_keysym_keycode_compare(void const *_a, void const *_b);
+// Fills keysym_keycodes with struct anthywl_keysym_keycode for every key of
+// the keymap, sorted by keysym.
+void anthywl_keysym_keycodes_index(struct anthywl_array *keysym_keycodes,
+    struct xkb_keymap *xkb_keymap);
+void anthywl_seat_bindings_set_up(struct anthywl_seat_bindings *seat_bindings,
+    struct anthywl_array const *bindings, struct anthywl_array const *keysym_keycodes,
+    xkb_mod_index_t const *mod_indices, xkb_keycode_t max_keycode);
+// Returns the action bound to the key with exactly these modifiers, or
+// ANTHYWL_ACTION_INVALID.
+enum anthywl_action anthywl_seat_bindings_find(
+    struct anthywl_seat_bindings const *bindings,
+    xkb_keycode_t keycode, xkb_mod_mask_t mod_mask);
+void anthywl_seat_bindings_finish(struct anthywl_seat_bindings *bindings);
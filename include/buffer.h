@@ -6,6 +6,7 @@ struct anthywl_buffer {
     char *text;
     size_t len;
     size_t pos;
+    size_t cap;
 };
 
 void anthywl_buffer_init(struct anthywl_buffer *);
@@ -18,3 +19,4 @@ void anthywl_buffer_move_left(struct anthywl_buffer *);
 void anthywl_buffer_move_right(struct anthywl_buffer *);
 void anthywl_buffer_convert_romaji(struct anthywl_buffer *);
 void anthywl_buffer_convert_trailing_n(struct anthywl_buffer *);
+void anthywl_buffer_convert_katakana(struct anthywl_buffer *);
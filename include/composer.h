@@ -0,0 +1,78 @@
+#pragma once
+
+#include <anthy/anthy.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "actions.h"
+#include "arena.h"
+#include "buffer.h"
+#include "config.h"
+#include "sink.h"
+
+enum anthywl_composer_update {
+    ANTHYWL_COMPOSER_UPDATE_COMPOSING = 1 << 0,
+    ANTHYWL_COMPOSER_UPDATE_SELECTING = 1 << 1,
+    ANTHYWL_COMPOSER_UPDATE_POPUP = 1 << 2,
+};
+
+struct anthywl_surrounding_text {
+    bool valid;
+    // A window of the client's surrounding text around the cursor.
+    char *text;
+    size_t len, cap;
+    // Byte offsets into text.
+    size_t cursor, anchor;
+};
+
+// A seat's preedit and its conversion, which actions work on. Everything it
+// shows or commits goes through its sink.
+struct anthywl_composer {
+    struct anthywl_sink const *sink;
+    // Whether a text input is active; without one, committed text is typed.
+    bool active;
+    struct anthywl_surrounding_text surrounding_text;
+    enum anthywl_input_mode input_mode;
+
+    // batching
+    int batch_depth;
+    enum anthywl_composer_update pending_updates;
+    // When the oldest key event not yet followed by a commit arrived.
+    uint64_t key_time;
+
+    struct anthywl_buffer buffer;
+    // Reset whenever pending updates are flushed.
+    struct anthywl_arena arena;
+
+    // composing
+    bool is_composing;
+    bool is_composing_popup_visible;
+
+    // selecting
+    bool is_selecting;
+    bool is_selecting_popup_visible;
+    int current_segment;
+    int segment_count;
+    int *selected_candidates;
+    anthy_context_t anthy_context;
+};
+
+void anthywl_composer_init(struct anthywl_composer *composer,
+    struct anthywl_sink const *sink);
+void anthywl_composer_finish(struct anthywl_composer *composer);
+bool anthywl_composer_is_batching(struct anthywl_composer *composer);
+void anthywl_composer_begin_batch(struct anthywl_composer *composer);
+void anthywl_composer_end_batch(struct anthywl_composer *composer);
+void anthywl_composer_flush_updates(struct anthywl_composer *composer);
+void anthywl_composer_update_popup(struct anthywl_composer *composer);
+char const *anthywl_composer_preedit_window(struct anthywl_composer *composer,
+    char const *text, size_t len, size_t *cursor_begin, size_t *cursor_end);
+void anthywl_composer_composing_update(struct anthywl_composer *composer);
+void anthywl_composer_composing_commit(struct anthywl_composer *composer);
+char *anthywl_composer_selecting_text(struct anthywl_composer *composer,
+    size_t *cursor_begin, size_t *cursor_end);
+void anthywl_composer_selecting_update(struct anthywl_composer *composer);
+void anthywl_composer_selecting_commit(struct anthywl_composer *composer);
+void anthywl_surrounding_text_set(struct anthywl_surrounding_text *surrounding,
+    char const *text, uint32_t cursor, uint32_t anchor);
@@ -1,15 +1,54 @@
 #pragma once
 
 #include <stdbool.h>
-#include <wayland-client-core.h>
+#include <stdint.h>
+
+#include "array.h"
+
+enum anthywl_config_change {
+    ANTHYWL_CONFIG_GLOBAL_BINDINGS = 1 << 0,
+    ANTHYWL_CONFIG_COMPOSING_BINDINGS = 1 << 1,
+    ANTHYWL_CONFIG_SELECTING_BINDINGS = 1 << 2,
+    ANTHYWL_CONFIG_CONTENT_TYPE_RULES = 1 << 3,
+};
+
+enum anthywl_input_mode {
+    ANTHYWL_INPUT_MODE_DEFAULT,
+    ANTHYWL_INPUT_MODE_PASSTHROUGH,
+    ANTHYWL_INPUT_MODE_LATIN,
+    ANTHYWL_INPUT_MODE_HIRAGANA,
+    ANTHYWL_INPUT_MODE_KATAKANA,
+};
+
+struct anthywl_content_type_rule {
+    // Matches a content type with any of these hints, or with this purpose.
+    bool is_hint;
+    uint32_t value;
+    enum anthywl_input_mode mode;
+};
 
 struct anthywl_config {
+    char *path;
+    // The closest existing directory on the way to the file, and its
+    // inotify watch.
+    char *watch_dir;
+    int watch_wd;
     bool active_at_startup;
-    struct wl_array global_bindings;
-    struct wl_array composing_bindings;
-    struct wl_array selecting_bindings;
+    // Minimum time between two states sent to a varlink monitor.
+    unsigned monitor_interval_ms;
+    struct anthywl_array global_bindings;
+    struct anthywl_array composing_bindings;
+    struct anthywl_array selecting_bindings;
+    // struct anthywl_content_type_rule, in file order.
+    struct anthywl_array content_type_rules;
 };
 
 void anthywl_config_init(struct anthywl_config *config);
 bool anthywl_config_load(struct anthywl_config *config);
+bool anthywl_config_reload(struct anthywl_config *config,
+    enum anthywl_config_change *changes);
+int anthywl_config_watch(struct anthywl_config *config);
+bool anthywl_config_read_watch_events(struct anthywl_config *config, int fd);
+enum anthywl_input_mode anthywl_config_input_mode(
+    struct anthywl_config *config, uint32_t hint, uint32_t purpose);
 void anthywl_config_finish(struct anthywl_config *config);
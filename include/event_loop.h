@@ -0,0 +1,38 @@
+#pragma once
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/epoll.h>
+
+struct anthywl_event_source {
+    int fd;
+    void (*callback)(struct anthywl_event_source *source, uint32_t events);
+};
+
+struct anthywl_signal_source {
+    struct anthywl_event_source source;
+    sigset_t mask, old_mask;
+    void (*callback)(struct anthywl_signal_source *source, int signal);
+};
+
+struct anthywl_event_loop {
+    int fd;
+    struct epoll_event events[32];
+    int events_len, events_pos;
+};
+
+bool anthywl_event_loop_init(struct anthywl_event_loop *loop);
+void anthywl_event_loop_finish(struct anthywl_event_loop *loop);
+bool anthywl_event_loop_add(struct anthywl_event_loop *loop,
+    struct anthywl_event_source *source, uint32_t events);
+bool anthywl_event_loop_modify(struct anthywl_event_loop *loop,
+    struct anthywl_event_source *source, uint32_t events);
+void anthywl_event_loop_remove(struct anthywl_event_loop *loop,
+    struct anthywl_event_source *source);
+bool anthywl_event_loop_add_signals(struct anthywl_event_loop *loop,
+    struct anthywl_signal_source *source, sigset_t const *mask);
+void anthywl_event_loop_remove_signals(struct anthywl_event_loop *loop,
+    struct anthywl_signal_source *source);
+int anthywl_event_loop_dispatch(struct anthywl_event_loop *loop, int timeout);
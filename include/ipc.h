@@ -1,14 +1,124 @@
 #pragma once
 
+#include <anthy/anthy.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <varlink.h>
+#include <wayland-client-core.h>
+
+#include "actions.h"
+#include "buffer.h"
+#include "event_loop.h"
+#include "queue.h"
+#include "timer.h"
+
+// Calls being worked on at once, across all clients. Further calls are
+// answered with Busy until some are finished.
+#define ANTHYWL_IPC_CALLS_MAX 64
+
+struct anthywl_ipc;
+struct anthywl_seat;
+
+// A call the IPC thread has passed on to the main thread. The main thread
+// only uses it to address replies.
+struct anthywl_ipc_call {
+    struct anthywl_ipc *ipc;
+    VarlinkCall *call;
+    // Only touched by the IPC thread.
+    bool canceled;
+};
+
+enum anthywl_ipc_command_type {
+    ANTHYWL_IPC_COMMAND_ACTIONS,
+    ANTHYWL_IPC_COMMAND_MONITOR,
+    ANTHYWL_IPC_COMMAND_CONVERT,
+    ANTHYWL_IPC_COMMAND_GET_METRICS,
+    // The client went away; no more replies will be sent for the call.
+    ANTHYWL_IPC_COMMAND_CANCELED,
+};
+
+// Sent from the IPC thread to the main thread.
+struct anthywl_ipc_command {
+    enum anthywl_ipc_command_type type;
+    struct anthywl_ipc_call *call;
+    char *seat;
+    // ACTIONS: whether this came from Action, which has an empty reply.
+    bool single;
+    enum anthywl_action *actions;
+    size_t actions_len;
+    // MONITOR
+    bool more;
+    // CONVERT, queued in anthywl_ipc::conversions while waiting.
+    struct wl_list link;
+    char *input;
+    int64_t max_candidates;
+    uint64_t queued;
+};
+
+// Sent from the main thread to the IPC thread, which takes ownership of
+// the parameters.
+struct anthywl_ipc_reply {
+    struct anthywl_ipc_call *call;
+    // An error name, or NULL for a normal reply.
+    char const *error;
+    VarlinkObject *parameters;
+    // Whether more replies follow; the last one releases the call.
+    bool continues;
+};
+
+// A Monitor call that is streaming a seat's state.
+struct anthywl_ipc_monitor {
+    struct wl_list link;
+    struct anthywl_ipc *ipc;
+    struct anthywl_seat *seat;
+    struct anthywl_ipc_call *call;
+    // Sends the latest state once the minimum interval has passed.
+    struct anthywl_timer timer;
+    uint64_t last_sent;
+    uint64_t last_hash;
+};
 
 struct anthywl_ipc {
+    struct anthywl_event_loop *event_loop;
+    // An eventfd the IPC thread signals when commands are queued.
+    struct anthywl_event_source source;
+    struct anthywl_queue commands;
+    struct anthywl_queue replies;
+    // An eventfd the main thread signals when replies are queued.
+    int thread_fd;
+    pthread_t thread;
+    bool thread_started;
+    atomic_bool stop;
+    atomic_bool failed;
+
+    // Owned by the IPC thread while it runs.
     VarlinkService *service;
+    size_t calls_len;
+
+    // Owned by the main thread.
+    // struct anthywl_ipc_monitor::link
+    struct wl_list monitors;
+    // struct anthywl_ipc_command::link, oldest last.
+    struct wl_list conversions;
+    struct anthywl_timer conversion_timer;
+    // The call being converted, taken off conversions, and its reply so
+    // far; segments up to conversion_segment have their candidates listed.
+    struct anthywl_ipc_command *conversion;
+    VarlinkObject *conversion_reply;
+    VarlinkArray *conversion_segments;
+    int conversion_segment, conversion_segments_len;
+    // Not shared with any seat, so conversions don't disturb one that is
+    // selecting.
+    anthy_context_t anthy_context;
+    struct anthywl_buffer conversion_buffer;
 };
 
 int anthywl_ipc_addr(char *addr, size_t size);
-bool anthywl_ipc_init(struct anthywl_ipc *ipc);
+bool anthywl_ipc_init(struct anthywl_ipc *ipc,
+    struct anthywl_event_loop *event_loop);
 void anthywl_ipc_finish(struct anthywl_ipc *ipc);
-long anthywl_ipc_handle_action(VarlinkService *service, VarlinkCall *call,
-    VarlinkObject *parameters, uint64_t flags, void *userdata);
+void anthywl_ipc_seat_changed(struct anthywl_ipc *ipc,
+    struct anthywl_seat *seat);
+void anthywl_ipc_seat_destroyed(struct anthywl_ipc *ipc,
+    struct anthywl_seat *seat);
@@ -4,6 +4,32 @@
 #include <stddef.h>
 #include <stdint.h>
 
-bool anthywl_make_keymap(char const *string,
-    int *out_keymap_fd, size_t *out_keymap_size,
-    uint32_t **out_keys, size_t *out_keys_size);
+#include <xkbcommon/xkbcommon.h>
+
+#include "array.h"
+
+// Keycodes 10 to 255, the highest keycode an XKB keymap can have.
+#define ANTHYWL_FALLBACK_KEYMAP_LEN 246
+
+// Keymap for typing arbitrary text through a virtual keyboard. Keysyms stay
+// assigned to their keycodes across commits, so a new keymap only has to be
+// sent when text uses a keysym that isn't in it yet.
+struct anthywl_fallback_keymap {
+    // Keysyms by slot; slot i is evdev key i + 2.
+    xkb_keysym_t keysyms[ANTHYWL_FALLBACK_KEYMAP_LEN];
+    uint64_t last_used[ANTHYWL_FALLBACK_KEYMAP_LEN];
+    // Slots sorted by keysym.
+    uint8_t index[ANTHYWL_FALLBACK_KEYMAP_LEN];
+    size_t len;
+    uint64_t generation;
+    bool dirty;
+};
+
+void anthywl_fallback_keymap_init(struct anthywl_fallback_keymap *keymap);
+// Maps as much of the text as fits in the keymap at once to evdev keys and
+// returns the number of bytes consumed.
+size_t anthywl_fallback_keymap_add_text(
+    struct anthywl_fallback_keymap *keymap,
+    char const *text, struct anthywl_array *keys);
+bool anthywl_fallback_keymap_write(struct anthywl_fallback_keymap *keymap,
+    int *out_keymap_fd, size_t *out_keymap_size);
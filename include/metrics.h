@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum anthywl_stage {
+    // From a key event to finding its binding, or finding there is none.
+    ANTHYWL_STAGE_BINDING_LOOKUP,
+    ANTHYWL_STAGE_ROMAJI,
+    // anthy_set_string and anthy_resize_segment.
+    ANTHYWL_STAGE_ANTHY,
+    ANTHYWL_STAGE_POPUP_LAYOUT,
+    ANTHYWL_STAGE_POPUP_RASTER,
+    ANTHYWL_STAGE_SHM_BUFFER,
+    // From a key event to the preedit update it caused.
+    ANTHYWL_STAGE_KEY_TO_PREEDIT,
+    // From a key event to the text it caused being committed.
+    ANTHYWL_STAGE_KEY_TO_COMMIT,
+    _ANTHYWL_STAGE_LAST,
+};
+
+enum anthywl_counter {
+    ANTHYWL_COUNTER_KEYS,
+    ANTHYWL_COUNTER_PREEDITS,
+    ANTHYWL_COUNTER_COMMITS,
+    ANTHYWL_COUNTER_POPUP_DRAWS,
+    ANTHYWL_COUNTER_BUFFERS_CREATED,
+    _ANTHYWL_COUNTER_LAST,
+};
+
+// Values below 8 have a bucket each; above that, every power of two is
+// split into 8 buckets, so a bucket is within 12.5% of its values. The
+// last bucket also holds everything above about 17 seconds.
+#define ANTHYWL_HISTOGRAM_BUCKETS 256
+
+// Durations in nanoseconds.
+struct anthywl_histogram {
+    uint64_t count, sum, max;
+    uint32_t buckets[ANTHYWL_HISTOGRAM_BUCKETS];
+};
+
+// Only updated from the main thread.
+struct anthywl_metrics {
+    struct anthywl_histogram stages[_ANTHYWL_STAGE_LAST];
+    uint64_t counters[_ANTHYWL_COUNTER_LAST];
+};
+
+extern struct anthywl_metrics anthywl_metrics;
+extern char const *const anthywl_stage_names[_ANTHYWL_STAGE_LAST];
+extern char const *const anthywl_counter_names[_ANTHYWL_COUNTER_LAST];
+
+void anthywl_histogram_add(struct anthywl_histogram *histogram,
+    uint64_t value);
+// The largest value in the bucket containing the given percentile.
+uint64_t anthywl_histogram_percentile(
+    struct anthywl_histogram const *histogram, double percentile);
+// Records the time since start, a CLOCK_MONOTONIC timestamp.
+void anthywl_metrics_record(enum anthywl_stage stage, uint64_t start);
+void anthywl_metrics_dump(FILE *f);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// An entry in a perfect hash table generated by buildtools/perfect_hash.py.
+struct anthywl_name {
+    char const *name;
+    int value;
+};
+
+uint32_t anthywl_name_hash(char const *name, uint32_t seed);
+// Returns the value for the name, or 0 if it isn't in the table.
+int anthywl_name_lookup(struct anthywl_name const *table, size_t table_len,
+    uint32_t seed, char const *name);
+
+#define ANTHYWL_NAME_LOOKUP(table, name) \
+    anthywl_name_lookup((table), sizeof (table) / sizeof *(table), \
+        table##_seed, (name))
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// A bounded queue of pointers between two threads. One thread pushes and
+// the other pops, without taking a lock.
+struct anthywl_queue {
+    void **items;
+    // A power of two.
+    size_t cap;
+    // Kept on separate cache lines, since each is written by one thread.
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+};
+
+bool anthywl_queue_init(struct anthywl_queue *queue, size_t cap);
+void anthywl_queue_finish(struct anthywl_queue *queue);
+// Returns false if the queue is full.
+bool anthywl_queue_push(struct anthywl_queue *queue, void *item);
+// Returns NULL if the queue is empty.
+void *anthywl_queue_pop(struct anthywl_queue *queue);
+size_t anthywl_queue_len(struct anthywl_queue *queue);
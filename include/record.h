@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct anthywl_state;
+
+// The input-method events a recording holds. Each record is a 64-bit time
+// in nanoseconds since recording started, this type as a byte, the 32-bit
+// index of the seat it happened on, and a 32-bit payload length, followed by
+// the payload: the event's integer arguments as 32-bit values, then its
+// text, if any. Everything is in host byte order.
+enum anthywl_record_type {
+    // format, keymap text
+    ANTHYWL_RECORD_KEYMAP,
+    // time, key, state
+    ANTHYWL_RECORD_KEY,
+    // depressed, latched, locked, group
+    ANTHYWL_RECORD_MODIFIERS,
+    // rate, delay
+    ANTHYWL_RECORD_REPEAT_INFO,
+    ANTHYWL_RECORD_ACTIVATE,
+    ANTHYWL_RECORD_DEACTIVATE,
+    // cursor, anchor, text
+    ANTHYWL_RECORD_SURROUNDING_TEXT,
+    // cause
+    ANTHYWL_RECORD_TEXT_CHANGE_CAUSE,
+    // hint, purpose
+    ANTHYWL_RECORD_CONTENT_TYPE,
+    ANTHYWL_RECORD_DONE,
+    _ANTHYWL_RECORD_LAST,
+};
+
+struct anthywl_recorder {
+    // NULL when not recording.
+    FILE *file;
+    uint64_t start;
+    // Seats given a record index so far.
+    uint32_t seats;
+};
+
+bool anthywl_recorder_open(struct anthywl_recorder *recorder,
+    char const *path);
+void anthywl_recorder_close(struct anthywl_recorder *recorder);
+void anthywl_recorder_write(struct anthywl_recorder *recorder,
+    uint32_t seat, enum anthywl_record_type type,
+    uint32_t const *fields, size_t fields_len,
+    char const *text, size_t text_len);
+bool anthywl_replay(struct anthywl_state *state, char const *path,
+    bool realtime);
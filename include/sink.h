@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct anthywl_composer;
+struct anthywl_graphics_buffer;
+struct anthywl_seat;
+
+// Where a seat's requests to the compositor go. Replaying a recorded
+// session swaps the Wayland one for one that only releases popup buffers.
+struct anthywl_sink {
+    // What a composer shows and commits.
+    void (*set_preedit_string)(struct anthywl_composer *composer,
+        char const *text, int32_t cursor_begin, int32_t cursor_end);
+    void (*commit_string)(struct anthywl_composer *composer,
+        char const *text);
+    void (*delete_surrounding_text)(struct anthywl_composer *composer,
+        uint32_t before_length, uint32_t after_length);
+    void (*commit)(struct anthywl_composer *composer);
+    // Committed text when no text input is active. Returns false if it
+    // couldn't be typed.
+    bool (*type_string)(struct anthywl_composer *composer, char const *text);
+    // Redraws the popup for the current preedit or candidates.
+    void (*update_popup)(struct anthywl_composer *composer);
+    // Called after each action, which may only have changed the mode.
+    void (*changed)(struct anthywl_composer *composer);
+
+    // The rest are only used by the seat itself.
+    // buffer is NULL when the popup is hidden.
+    void (*show_popup)(struct anthywl_seat *seat,
+        struct anthywl_graphics_buffer *buffer, int scale);
+    // Keys not handled by anthywl, passed on to the client.
+    void (*forward_keymap)(struct anthywl_seat *seat,
+        uint32_t format, int32_t fd, uint32_t size);
+    void (*forward_key)(struct anthywl_seat *seat,
+        uint32_t time, uint32_t key, uint32_t state);
+    void (*forward_modifiers)(struct anthywl_seat *seat,
+        uint32_t mods_depressed, uint32_t mods_latched, uint32_t mods_locked,
+        uint32_t group);
+    // Text typed through a generated keymap when no text input is active.
+    void (*type_keymap)(struct anthywl_seat *seat,
+        uint32_t format, int32_t fd, uint32_t size);
+    void (*type_key)(struct anthywl_seat *seat, uint32_t key, uint32_t state);
+    void (*flush)(struct anthywl_seat *seat);
+};
+
+extern struct anthywl_sink const anthywl_wayland_sink;
+extern struct anthywl_sink const anthywl_null_sink;
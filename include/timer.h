@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct anthywl_timer {
+    // 1-based position in the queue's heap, 0 when not armed.
+    size_t index;
+    // CLOCK_MONOTONIC, in nanoseconds.
+    uint64_t deadline;
+    void (*callback)(struct anthywl_timer *timer);
+};
+
+struct anthywl_timer_queue {
+    int fd;
+    struct anthywl_timer **heap;
+    size_t len, cap;
+    uint64_t armed_deadline;
+};
+
+uint64_t anthywl_timer_now(void);
+bool anthywl_timer_queue_init(struct anthywl_timer_queue *queue);
+void anthywl_timer_queue_finish(struct anthywl_timer_queue *queue);
+void anthywl_timer_queue_dispatch(struct anthywl_timer_queue *queue);
+void anthywl_timer_arm(struct anthywl_timer_queue *queue,
+    struct anthywl_timer *timer, uint64_t deadline);
+void anthywl_timer_cancel(struct anthywl_timer_queue *queue,
+    struct anthywl_timer *timer);
+bool anthywl_timer_is_armed(struct anthywl_timer const *timer);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Begin and end events around the interesting parts of handling input,
+// written as Chrome trace-event JSON with --trace=FILE. Without tracing
+// support built in, the macros expand to nothing.
+
+#ifdef ANTHYWL_TRACE_SUPPORT
+
+#include <stdatomic.h>
+
+extern atomic_bool anthywl_trace_enabled;
+
+bool anthywl_trace_start(char const *path);
+void anthywl_trace_stop(void);
+// The name must outlive the trace; string literals are fine.
+void anthywl_trace_event(char const *name, char phase);
+
+#define ANTHYWL_TRACE_BEGIN(name) do { \
+    if (atomic_load_explicit(&anthywl_trace_enabled, memory_order_relaxed)) \
+        anthywl_trace_event((name), 'B'); \
+} while (0)
+#define ANTHYWL_TRACE_END(name) do { \
+    if (atomic_load_explicit(&anthywl_trace_enabled, memory_order_relaxed)) \
+        anthywl_trace_event((name), 'E'); \
+} while (0)
+
+#else
+
+#define ANTHYWL_TRACE_BEGIN(name) ((void)0)
+#define ANTHYWL_TRACE_END(name) ((void)0)
+
+#endif
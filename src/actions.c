@@ -1,355 +1,451 @@
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include "anthywl.h"
 #include "actions.h"
+#include "composer.h"
+#include "metrics.h"
+#include "timer.h"
+#include "trace.h"
 
 #define ARRAY_LEN(x) (sizeof (x) / sizeof *(x))
 
-static bool anthywl_seat_handle_enable(struct anthywl_seat *seat) {
-    seat->is_composing = true;
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+static bool anthywl_composer_handle_enable(struct anthywl_composer *composer) {
+    composer->is_composing = true;
     return true;
 }
 
-static bool anthywl_seat_handle_disable(struct anthywl_seat *seat) {
-    seat->is_composing = false;
-    seat->is_selecting_popup_visible = false;
-    anthywl_buffer_clear(&seat->buffer);
-    anthywl_seat_composing_update(seat);
+static bool anthywl_composer_handle_disable(struct anthywl_composer *composer) {
+    composer->is_composing = false;
+    composer->is_selecting_popup_visible = false;
+    anthywl_buffer_clear(&composer->buffer);
+    anthywl_composer_composing_update(composer);
     return true;
 }
 
-static bool anthywl_seat_handle_toggle(struct anthywl_seat *seat) {
-    if (seat->is_composing)
-        return anthywl_seat_handle_disable(seat);
+static bool anthywl_composer_handle_toggle(struct anthywl_composer *composer) {
+    if (composer->is_composing)
+        return anthywl_composer_handle_disable(composer);
     else
-        return anthywl_seat_handle_enable(seat);
+        return anthywl_composer_handle_enable(composer);
 }
 
-static bool anthywl_seat_handle_delete_left(struct anthywl_seat *seat) {
-    if (!seat->is_composing)
+static bool anthywl_composer_handle_delete_left(
+    struct anthywl_composer *composer)
+{
+    if (!composer->is_composing)
         return true;
-    if (seat->buffer.len == 0)
+    if (composer->buffer.len == 0)
         return true;
-    if (seat->is_selecting) {
-        seat->is_selecting = false;
-        seat->is_selecting_popup_visible = false;
+    if (composer->is_selecting) {
+        composer->is_selecting = false;
+        composer->is_selecting_popup_visible = false;
     }
-    anthywl_buffer_delete_backwards(&seat->buffer, 1);
-    anthywl_seat_composing_update(seat);
+    anthywl_buffer_delete_backwards(&composer->buffer, 1);
+    anthywl_composer_composing_update(composer);
     return true;
 }
 
-static bool anthywl_seat_handle_delete_right(struct anthywl_seat *seat) {
-    if (!seat->is_composing)
+static bool anthywl_composer_handle_delete_right(
+    struct anthywl_composer *composer)
+{
+    if (!composer->is_composing)
         return true;
-    if (seat->buffer.len == 0)
+    if (composer->buffer.len == 0)
         return true;
-    if (seat->is_selecting) {
-        seat->is_selecting = false;
-        seat->is_selecting_popup_visible = false;
+    if (composer->is_selecting) {
+        composer->is_selecting = false;
+        composer->is_selecting_popup_visible = false;
     }
-    anthywl_buffer_delete_forwards(&seat->buffer, 1);
-    anthywl_seat_composing_update(seat);
+    anthywl_buffer_delete_forwards(&composer->buffer, 1);
+    anthywl_composer_composing_update(composer);
     return true;
 }
 
-static bool anthywl_seat_handle_move_left(struct anthywl_seat *seat) {
-    if (!seat->is_composing)
+static bool anthywl_composer_handle_move_left(
+    struct anthywl_composer *composer)
+{
+    if (!composer->is_composing)
         return true;
-    if (seat->buffer.len == 0)
+    if (composer->buffer.len == 0)
         return true;
-    if (seat->is_selecting) {
+    if (composer->is_selecting) {
         anthy_commit_segment(
-            seat->anthy_context,
-            seat->current_segment,
-            seat->selected_candidates[seat->current_segment]);
-        if (seat->current_segment != 0)
-            seat->current_segment -= 1;
-        anthywl_seat_selecting_update(seat);
+            composer->anthy_context,
+            composer->current_segment,
+            composer->selected_candidates[composer->current_segment]);
+        if (composer->current_segment != 0)
+            composer->current_segment -= 1;
+        anthywl_composer_selecting_update(composer);
         return true;
     }
-    anthywl_buffer_move_left(&seat->buffer);
-    anthywl_seat_composing_update(seat);
+    anthywl_buffer_move_left(&composer->buffer);
+    anthywl_composer_composing_update(composer);
     return true;
 }
 
-static bool anthywl_seat_handle_move_right(struct anthywl_seat *seat) {
-    if (!seat->is_composing)
+static bool anthywl_composer_handle_move_right(
+    struct anthywl_composer *composer)
+{
+    if (!composer->is_composing)
         return true;
-    if (seat->buffer.len == 0)
+    if (composer->buffer.len == 0)
         return true;
-    if (seat->is_selecting) {
+    if (composer->is_selecting) {
         anthy_commit_segment(
-            seat->anthy_context,
-            seat->current_segment,
-            seat->selected_candidates[seat->current_segment]);
-        if (seat->current_segment != seat->segment_count - 1)
-            seat->current_segment += 1;
-        anthywl_seat_selecting_update(seat);
+            composer->anthy_context,
+            composer->current_segment,
+            composer->selected_candidates[composer->current_segment]);
+        if (composer->current_segment != composer->segment_count - 1)
+            composer->current_segment += 1;
+        anthywl_composer_selecting_update(composer);
         return true;
     }
-    anthywl_buffer_move_right(&seat->buffer);
-    anthywl_seat_composing_update(seat);
+    anthywl_buffer_move_right(&composer->buffer);
+    anthywl_composer_composing_update(composer);
     return true;
 }
 
-static void anthywl_seat_expand(struct anthywl_seat *seat, int amount) {
+static void anthywl_composer_expand(
+    struct anthywl_composer *composer, int amount)
+{
+    uint64_t start = anthywl_timer_now();
+    ANTHYWL_TRACE_BEGIN("anthy_resize_segment");
     anthy_resize_segment(
-        seat->anthy_context, seat->current_segment, amount);
+        composer->anthy_context, composer->current_segment, amount);
+    ANTHYWL_TRACE_END("anthy_resize_segment");
+    anthywl_metrics_record(ANTHYWL_STAGE_ANTHY, start);
     struct anthy_conv_stat conv_stat;
-    anthy_get_stat(seat->anthy_context, &conv_stat);
-    seat->selected_candidates = realloc(
-        seat->selected_candidates, conv_stat.nr_segment * sizeof(int));
-    memset(seat->selected_candidates, 0, conv_stat.nr_segment * sizeof(int));
-    seat->segment_count = conv_stat.nr_segment;
-    anthywl_seat_selecting_update(seat);
+    anthy_get_stat(composer->anthy_context, &conv_stat);
+    composer->selected_candidates = realloc(
+        composer->selected_candidates, conv_stat.nr_segment * sizeof(int));
+    memset(composer->selected_candidates, 0,
+        conv_stat.nr_segment * sizeof(int));
+    composer->segment_count = conv_stat.nr_segment;
+    anthywl_composer_selecting_update(composer);
 }
 
-static bool anthywl_seat_handle_expand_left(struct anthywl_seat *seat) {
-    if (!seat->is_selecting)
+static bool anthywl_composer_handle_expand_left(
+    struct anthywl_composer *composer)
+{
+    if (!composer->is_selecting)
         return true;
-    anthywl_seat_expand(seat, -1);
+    anthywl_composer_expand(composer, -1);
     return true;
 }
 
-static bool anthywl_seat_handle_expand_right(struct anthywl_seat *seat) {
-    if (!seat->is_selecting)
+static bool anthywl_composer_handle_expand_right(
+    struct anthywl_composer *composer)
+{
+    if (!composer->is_selecting)
         return true;
-    anthywl_seat_expand(seat, 1);
+    anthywl_composer_expand(composer, 1);
     return true;
 }
 
-static bool anthywl_seat_handle_select(struct anthywl_seat *seat) {
-    if (!seat->is_composing)
+// Converts the buffer and starts selecting candidates. Text already
+// converted, as when reconverting, is given to Anthy as such; read as kana,
+// its kanji would only ever come back unchanged.
+static void anthywl_composer_convert(struct anthywl_composer *composer,
+    bool reconversion)
+{
+    composer->is_selecting = true;
+    composer->is_selecting_popup_visible = true;
+    anthy_reset_context(composer->anthy_context);
+    uint64_t start = anthywl_timer_now();
+    if (reconversion) {
+        ANTHYWL_TRACE_BEGIN("anthy_set_reconversion_string");
+        anthy_set_reconversion_string(
+            composer->anthy_context, composer->buffer.text);
+        ANTHYWL_TRACE_END("anthy_set_reconversion_string");
+    } else {
+        ANTHYWL_TRACE_BEGIN("anthy_set_string");
+        anthy_set_string(composer->anthy_context, composer->buffer.text);
+        ANTHYWL_TRACE_END("anthy_set_string");
+    }
+    anthywl_metrics_record(ANTHYWL_STAGE_ANTHY, start);
+    struct anthy_conv_stat conv_stat;
+    anthy_get_stat(composer->anthy_context, &conv_stat);
+    free(composer->selected_candidates);
+    composer->selected_candidates = calloc(conv_stat.nr_segment, sizeof(int));
+    composer->segment_count = conv_stat.nr_segment;
+    composer->current_segment = 0;
+    anthywl_composer_selecting_update(composer);
+}
+
+static bool anthywl_composer_handle_select(struct anthywl_composer *composer) {
+    if (!composer->is_composing)
         return true;
-    if (seat->is_selecting)
+    if (composer->is_selecting)
         return true;
-    if (seat->buffer.len == 0)
+    if (composer->buffer.len == 0)
         return true;
-    anthywl_buffer_convert_trailing_n(&seat->buffer);
-    seat->is_selecting = true;
-    seat->is_selecting_popup_visible = true;
-    anthy_reset_context(seat->anthy_context);
-    anthy_set_string(seat->anthy_context, seat->buffer.text);
-    struct anthy_conv_stat conv_stat;
-    anthy_get_stat(seat->anthy_context, &conv_stat);
-    free(seat->selected_candidates);
-    seat->selected_candidates = calloc(conv_stat.nr_segment, sizeof(int));
-    seat->segment_count = conv_stat.nr_segment;
-    seat->current_segment = 0;
-    anthywl_seat_selecting_update(seat);
+    anthywl_buffer_convert_trailing_n(&composer->buffer);
+    if (composer->input_mode == ANTHYWL_INPUT_MODE_KATAKANA)
+        anthywl_buffer_convert_katakana(&composer->buffer);
+    anthywl_composer_convert(composer, false);
     return true;
 }
 
-static bool anthywl_seat_handle_compose(struct anthywl_seat *seat) {
-    if (!seat->is_composing)
-        return anthywl_seat_handle_enable(seat);
-    if (!seat->is_selecting)
+static bool anthywl_composer_handle_compose(struct anthywl_composer *composer) {
+    if (!composer->is_composing)
+        return anthywl_composer_handle_enable(composer);
+    if (!composer->is_selecting)
         return true;
-    seat->is_selecting = false;
-    anthywl_seat_composing_update(seat);
+    composer->is_selecting = false;
+    anthywl_composer_composing_update(composer);
     return true;
 }
 
-static bool anthywl_seat_handle_accept(struct anthywl_seat *seat) {
-    if (!seat->is_composing)
+static bool anthywl_composer_handle_accept(struct anthywl_composer *composer) {
+    if (!composer->is_composing)
         return true;
-    if (seat->buffer.len == 0)
+    if (composer->buffer.len == 0)
         return true;
-    if (seat->is_selecting)
-        anthywl_seat_selecting_commit(seat);
+    if (composer->is_selecting)
+        anthywl_composer_selecting_commit(composer);
     else
-        anthywl_seat_composing_commit(seat);
+        anthywl_composer_composing_commit(composer);
     return true;
 }
 
-static bool anthywl_seat_handle_discard(struct anthywl_seat *seat) {
-    if (!seat->is_composing)
+static bool anthywl_composer_handle_discard(struct anthywl_composer *composer) {
+    if (!composer->is_composing)
         return true;
-    if (seat->is_selecting)
-        seat->is_selecting = false;
-    anthywl_buffer_clear(&seat->buffer);
-    anthywl_seat_composing_commit(seat);
+    if (composer->is_selecting)
+        composer->is_selecting = false;
+    anthywl_buffer_clear(&composer->buffer);
+    anthywl_composer_composing_commit(composer);
     return true;
 }
 
-static bool anthywl_seat_handle_prev_candidate(struct anthywl_seat *seat) {
-    if (!seat->is_selecting)
+static bool anthywl_composer_handle_prev_candidate(
+    struct anthywl_composer *composer)
+{
+    if (!composer->is_selecting)
         return true;
 
     struct anthy_conv_stat conv_stat;
-    anthy_get_stat(seat->anthy_context, &conv_stat);
-    assert(conv_stat.nr_segment == seat->segment_count);
+    anthy_get_stat(composer->anthy_context, &conv_stat);
+    assert(conv_stat.nr_segment == composer->segment_count);
 
     struct anthy_segment_stat segment_stat;
     anthy_get_segment_stat(
-        seat->anthy_context, seat->current_segment, &segment_stat);
+        composer->anthy_context, composer->current_segment, &segment_stat);
 
-    if (seat->selected_candidates[seat->current_segment] != 0)
-        seat->selected_candidates[seat->current_segment] -= 1;
-    seat->is_selecting_popup_visible = true;
-    anthywl_seat_selecting_update(seat);
+    if (composer->selected_candidates[composer->current_segment] != 0)
+        composer->selected_candidates[composer->current_segment] -= 1;
+    composer->is_selecting_popup_visible = true;
+    anthywl_composer_selecting_update(composer);
 
     return true;
 }
 
-static bool anthywl_seat_handle_next_candidate(struct anthywl_seat *seat) {
-    if (!seat->is_selecting)
+static bool anthywl_composer_handle_next_candidate(
+    struct anthywl_composer *composer)
+{
+    if (!composer->is_selecting)
         return true;
 
     struct anthy_conv_stat conv_stat;
-    anthy_get_stat(seat->anthy_context, &conv_stat);
-    assert(conv_stat.nr_segment == seat->segment_count);
+    anthy_get_stat(composer->anthy_context, &conv_stat);
+    assert(conv_stat.nr_segment == composer->segment_count);
 
     struct anthy_segment_stat segment_stat;
     anthy_get_segment_stat(
-        seat->anthy_context, seat->current_segment, &segment_stat);
+        composer->anthy_context, composer->current_segment, &segment_stat);
 
-    if (seat->selected_candidates[seat->current_segment]
+    if (composer->selected_candidates[composer->current_segment]
         != segment_stat.nr_candidate - 1)
     {
-        seat->selected_candidates[seat->current_segment] += 1;
+        composer->selected_candidates[composer->current_segment] += 1;
     }
-    seat->is_selecting_popup_visible = true;
-    anthywl_seat_selecting_update(seat);
+    composer->is_selecting_popup_visible = true;
+    anthywl_composer_selecting_update(composer);
 
     return true;
 }
 
-static bool anthywl_seat_handle_cycle_candidate(struct anthywl_seat *seat) {
-    if (!seat->is_selecting)
+static bool anthywl_composer_handle_cycle_candidate(
+    struct anthywl_composer *composer)
+{
+    if (!composer->is_selecting)
         return true;
 
     struct anthy_conv_stat conv_stat;
-    anthy_get_stat(seat->anthy_context, &conv_stat);
-    assert(conv_stat.nr_segment == seat->segment_count);
+    anthy_get_stat(composer->anthy_context, &conv_stat);
+    assert(conv_stat.nr_segment == composer->segment_count);
 
     struct anthy_segment_stat segment_stat;
     anthy_get_segment_stat(
-        seat->anthy_context, seat->current_segment, &segment_stat);
+        composer->anthy_context, composer->current_segment, &segment_stat);
 
-    if (seat->selected_candidates[seat->current_segment]
+    if (composer->selected_candidates[composer->current_segment]
         != segment_stat.nr_candidate - 1)
     {
-        seat->selected_candidates[seat->current_segment] += 1;
+        composer->selected_candidates[composer->current_segment] += 1;
     }
-    seat->is_selecting_popup_visible = true;
-    anthywl_seat_selecting_update(seat);
+    composer->is_selecting_popup_visible = true;
+    anthywl_composer_selecting_update(composer);
 
     return true;
 }
 
-static bool anthywl_seat_handle_select_special_candidate(
-    struct anthywl_seat *seat, int idx)
+static bool anthywl_composer_handle_select_special_candidate(
+    struct anthywl_composer *composer, int idx)
 {
-    if (!seat->is_selecting)
+    if (!composer->is_selecting)
         return true;
 
-    seat->selected_candidates[seat->current_segment] = idx;
-    seat->is_selecting_popup_visible = true;
-    anthywl_seat_selecting_update(seat);
+    composer->selected_candidates[composer->current_segment] = idx;
+    composer->is_selecting_popup_visible = true;
+    anthywl_composer_selecting_update(composer);
 
     return true;
 }
 
-static bool anthywl_seat_handle_select_unconverted_candidate(
-    struct anthywl_seat *seat)
+static bool anthywl_composer_handle_select_unconverted_candidate(
+    struct anthywl_composer *composer)
 {
-    return anthywl_seat_handle_select_special_candidate(
-        seat, NTH_UNCONVERTED_CANDIDATE);
+    return anthywl_composer_handle_select_special_candidate(
+        composer, NTH_UNCONVERTED_CANDIDATE);
 }
 
-static bool anthywl_seat_handle_select_katakana_candidate(
-    struct anthywl_seat *seat)
+static bool anthywl_composer_handle_select_katakana_candidate(
+    struct anthywl_composer *composer)
 {
-    return anthywl_seat_handle_select_special_candidate(
-        seat, NTH_KATAKANA_CANDIDATE);
+    return anthywl_composer_handle_select_special_candidate(
+        composer, NTH_KATAKANA_CANDIDATE);
 }
 
-static bool anthywl_seat_handle_select_hiragana_candidate(
-    struct anthywl_seat *seat)
+static bool anthywl_composer_handle_select_hiragana_candidate(
+    struct anthywl_composer *composer)
 {
-    return anthywl_seat_handle_select_special_candidate(
-        seat, NTH_HIRAGANA_CANDIDATE);
+    return anthywl_composer_handle_select_special_candidate(
+        composer, NTH_HIRAGANA_CANDIDATE);
 }
 
-static bool anthywl_seat_handle_select_halfkana_candidate(
-    struct anthywl_seat *seat)
+static bool anthywl_composer_handle_select_halfkana_candidate(
+    struct anthywl_composer *composer)
 {
-    return anthywl_seat_handle_select_special_candidate(
-        seat, NTH_HALFKANA_CANDIDATE);
+    return anthywl_composer_handle_select_special_candidate(
+        composer, NTH_HALFKANA_CANDIDATE);
+}
+
+// Reconverting more than this at once is slow and rarely what's wanted.
+#define RECONVERT_MAX 96
+
+static bool is_utf8_continuation(char c) {
+    return (c & 0xc0) == 0x80;
+}
+
+// Whether the character at text[i] ends the text to reconvert: ASCII, the
+// ideographic space, or Japanese punctuation.
+static bool is_reconvert_boundary(char const *text, size_t i) {
+    unsigned char const *s = (unsigned char const *)text + i;
+    return s[0] < 0x80 || (s[0] == 0xe3 && s[1] == 0x80 && s[2] <= 0x83);
 }
 
-enum anthywl_action anthywl_action_from_string(const char *name) {
-    // TODO: use bsearch
-    static struct{
-        char const *name;
-        enum anthywl_action action;
-    } const actions[] = {
-        { "enable", ANTHYWL_ACTION_ENABLE },
-        { "disable", ANTHYWL_ACTION_DISABLE },
-        { "toggle", ANTHYWL_ACTION_TOGGLE },
-        { "delete-left", ANTHYWL_ACTION_DELETE_LEFT },
-        { "delete-right", ANTHYWL_ACTION_DELETE_RIGHT },
-        { "move-left", ANTHYWL_ACTION_MOVE_LEFT },
-        { "move-right", ANTHYWL_ACTION_MOVE_RIGHT },
-        { "expand-left", ANTHYWL_ACTION_EXPAND_LEFT },
-        { "expand-right", ANTHYWL_ACTION_EXPAND_RIGHT },
-        { "select", ANTHYWL_ACTION_SELECT },
-        { "compose", ANTHYWL_ACTION_COMPOSE },
-        { "accept", ANTHYWL_ACTION_ACCEPT },
-        { "discard", ANTHYWL_ACTION_DISCARD },
-        { "prev-candidate", ANTHYWL_ACTION_PREV_CANDIDATE },
-        { "next-candidate", ANTHYWL_ACTION_NEXT_CANDIDATE },
-        { "cycle-candidate", ANTHYWL_ACTION_CYCLE_CANDIDATE },
-        { "select-unconverted-candidate", ANTHYWL_ACTION_SELECT_UNCONVERTED_CANDIDATE },
-        { "select-katakana-candidate", ANTHYWL_ACTION_SELECT_KATAKANA_CANDIDATE },
-        { "select-hiragana-candidate", ANTHYWL_ACTION_SELECT_HIRAGANA_CANDIDATE },
-        { "select-halfkana-candidate", ANTHYWL_ACTION_SELECT_HALFKANA_CANDIDATE },
-    };
-
-    for (size_t i = 0; i < ARRAY_LEN(actions); i++) {
-        if (strcmp(name, actions[i].name) == 0)
-            return actions[i].action;
+static bool anthywl_composer_handle_reconvert(
+    struct anthywl_composer *composer)
+{
+    // Passing the key on while there's a preedit would commit it, then
+    // reconvert against surrounding text that doesn't include it yet.
+    if (composer->is_selecting || composer->buffer.len != 0)
+        return true;
+    // When there's nothing to reconvert, the key is passed on to the client.
+    struct anthywl_surrounding_text *surrounding = &composer->surrounding_text;
+    if (!composer->active || !surrounding->valid)
+        return false;
+
+    size_t start, end;
+    uint32_t before_length = 0, after_length = 0;
+    if (surrounding->cursor != surrounding->anchor) {
+        // delete_surrounding_text lengths leave out the selection, so it
+        // can't be deleted explicitly. Clients replace the selection with
+        // the preedit instead, as they must for typing over a selection.
+        start = min(surrounding->cursor, surrounding->anchor);
+        end = max(surrounding->cursor, surrounding->anchor);
+        if (end - start > RECONVERT_MAX)
+            return false;
+    } else {
+        end = surrounding->cursor;
+        start = end;
+        while (start > 0) {
+            size_t prev = start - 1;
+            while (prev > 0 && is_utf8_continuation(surrounding->text[prev]))
+                prev--;
+            if (end - prev > RECONVERT_MAX
+                || is_reconvert_boundary(surrounding->text, prev))
+            {
+                break;
+            }
+            start = prev;
+        }
+        before_length = end - start;
     }
+    if (start == end)
+        return false;
 
-    return ANTHYWL_ACTION_INVALID;
+    char *text = anthywl_arena_alloc(&composer->arena, end - start + 1);
+    memcpy(text, surrounding->text + start, end - start);
+    text[end - start] = '\0';
+    // The surrounding text is stale until the client sends it again.
+    surrounding->valid = false;
+
+    if (before_length != 0) {
+        composer->sink->delete_surrounding_text(
+            composer, before_length, after_length);
+    }
+    composer->is_composing = true;
+    anthywl_buffer_clear(&composer->buffer);
+    anthywl_buffer_append(&composer->buffer, text);
+    anthywl_composer_convert(composer, true);
+    return true;
 }
 
-static bool(*const anthywl_seat_action_handlers[_ANTHYWL_ACTION_LAST])
-    (struct anthywl_seat *) =
+static bool(*const anthywl_composer_action_handlers[_ANTHYWL_ACTION_LAST])
+    (struct anthywl_composer *) =
 {
-    [ANTHYWL_ACTION_ENABLE] = anthywl_seat_handle_enable,
-    [ANTHYWL_ACTION_DISABLE] = anthywl_seat_handle_disable,
-    [ANTHYWL_ACTION_TOGGLE] = anthywl_seat_handle_toggle,
-    [ANTHYWL_ACTION_DELETE_LEFT] = anthywl_seat_handle_delete_left,
-    [ANTHYWL_ACTION_DELETE_RIGHT] = anthywl_seat_handle_delete_right,
-    [ANTHYWL_ACTION_MOVE_LEFT] = anthywl_seat_handle_move_left,
-    [ANTHYWL_ACTION_MOVE_RIGHT] = anthywl_seat_handle_move_right,
-    [ANTHYWL_ACTION_EXPAND_LEFT] = anthywl_seat_handle_expand_left,
-    [ANTHYWL_ACTION_EXPAND_RIGHT] = anthywl_seat_handle_expand_right,
-    [ANTHYWL_ACTION_SELECT] = anthywl_seat_handle_select,
-    [ANTHYWL_ACTION_COMPOSE] = anthywl_seat_handle_compose,
-    [ANTHYWL_ACTION_ACCEPT] = anthywl_seat_handle_accept,
-    [ANTHYWL_ACTION_DISCARD] = anthywl_seat_handle_discard,
-    [ANTHYWL_ACTION_PREV_CANDIDATE] = anthywl_seat_handle_prev_candidate,
-    [ANTHYWL_ACTION_NEXT_CANDIDATE] = anthywl_seat_handle_next_candidate,
-    [ANTHYWL_ACTION_CYCLE_CANDIDATE] = anthywl_seat_handle_cycle_candidate,
-    [ANTHYWL_ACTION_SELECT_UNCONVERTED_CANDIDATE] = anthywl_seat_handle_select_unconverted_candidate,
-    [ANTHYWL_ACTION_SELECT_KATAKANA_CANDIDATE] = anthywl_seat_handle_select_katakana_candidate,
-    [ANTHYWL_ACTION_SELECT_HIRAGANA_CANDIDATE] = anthywl_seat_handle_select_hiragana_candidate,
-    [ANTHYWL_ACTION_SELECT_HALFKANA_CANDIDATE] = anthywl_seat_handle_select_halfkana_candidate,
+    [ANTHYWL_ACTION_ENABLE] = anthywl_composer_handle_enable,
+    [ANTHYWL_ACTION_DISABLE] = anthywl_composer_handle_disable,
+    [ANTHYWL_ACTION_TOGGLE] = anthywl_composer_handle_toggle,
+    [ANTHYWL_ACTION_DELETE_LEFT] = anthywl_composer_handle_delete_left,
+    [ANTHYWL_ACTION_DELETE_RIGHT] = anthywl_composer_handle_delete_right,
+    [ANTHYWL_ACTION_MOVE_LEFT] = anthywl_composer_handle_move_left,
+    [ANTHYWL_ACTION_MOVE_RIGHT] = anthywl_composer_handle_move_right,
+    [ANTHYWL_ACTION_EXPAND_LEFT] = anthywl_composer_handle_expand_left,
+    [ANTHYWL_ACTION_EXPAND_RIGHT] = anthywl_composer_handle_expand_right,
+    [ANTHYWL_ACTION_SELECT] = anthywl_composer_handle_select,
+    [ANTHYWL_ACTION_COMPOSE] = anthywl_composer_handle_compose,
+    [ANTHYWL_ACTION_ACCEPT] = anthywl_composer_handle_accept,
+    [ANTHYWL_ACTION_DISCARD] = anthywl_composer_handle_discard,
+    [ANTHYWL_ACTION_PREV_CANDIDATE] = anthywl_composer_handle_prev_candidate,
+    [ANTHYWL_ACTION_NEXT_CANDIDATE] = anthywl_composer_handle_next_candidate,
+    [ANTHYWL_ACTION_CYCLE_CANDIDATE] = anthywl_composer_handle_cycle_candidate,
+    [ANTHYWL_ACTION_SELECT_UNCONVERTED_CANDIDATE] = anthywl_composer_handle_select_unconverted_candidate,
+    [ANTHYWL_ACTION_SELECT_KATAKANA_CANDIDATE] = anthywl_composer_handle_select_katakana_candidate,
+    [ANTHYWL_ACTION_SELECT_HIRAGANA_CANDIDATE] = anthywl_composer_handle_select_hiragana_candidate,
+    [ANTHYWL_ACTION_SELECT_HALFKANA_CANDIDATE] = anthywl_composer_handle_select_halfkana_candidate,
+    [ANTHYWL_ACTION_RECONVERT] = anthywl_composer_handle_reconvert,
 };
 
-bool anthywl_seat_handle_action(struct anthywl_seat *seat,
+bool anthywl_composer_handle_action(struct anthywl_composer *composer,
     enum anthywl_action action)
 {
     if (action <= ANTHYWL_ACTION_INVALID || action >= _ANTHYWL_ACTION_LAST)
         return false;
-    bool (*handler)(struct anthywl_seat *)
-        = anthywl_seat_action_handlers[action];
+    bool (*handler)(struct anthywl_composer *)
+        = anthywl_composer_action_handlers[action];
     if (!handler)
         return false;
-    return handler(seat);
+    ANTHYWL_TRACE_BEGIN(anthywl_action_to_string(action));
+    bool handled = handler(composer);
+    ANTHYWL_TRACE_END(anthywl_action_to_string(action));
+    // Some actions only change the mode, without updating the preedit.
+    composer->sink->changed(composer);
+    return handled;
 }
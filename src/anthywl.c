@@ -1,7 +1,6 @@
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
-#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -9,7 +8,6 @@
 #include <string.h>
 #include <time.h>
 
-#include <poll.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
@@ -22,6 +20,7 @@
 #include <wayland-cursor.h>
 #include <xkbcommon/xkbcommon.h>
 
+#include "cursor-shape-v1-client-protocol.h"
 #include "input-method-unstable-v2-client-protocol.h"
 #include "text-input-unstable-v3-client-protocol.h"
 #include "virtual-keyboard-unstable-v1-client-protocol.h"
@@ -61,232 +60,219 @@ void zwp_input_popup_surface_v2_text_input_rectangle(void *data,
 #define BORDER (1.0)
 #define PADDING (5.0)
 
-struct anthywl_graphics_buffer *anthywl_seat_composing_draw_popup(
-    struct anthywl_seat *seat, int scale)
+static int anthywl_ceil(double x) {
+    int i = (int)x;
+    return i < x ? i + 1 : i;
+}
+
+// Gets a buffer for a popup of the given size, with the background and
+// border drawn. The caller draws the contents and restores the cairo state.
+static struct anthywl_graphics_buffer *anthywl_seat_begin_draw_popup(
+    struct anthywl_seat *seat, double width, double height, int scale)
 {
-    cairo_surface_t *recording_cairo_surface =
-        cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, NULL);
-    cairo_t *recording_cairo = cairo_create(recording_cairo_surface);
-    PangoLayout *layout = pango_cairo_create_layout(recording_cairo);
+    uint64_t start = anthywl_timer_now();
+    struct anthywl_graphics_buffer *buffer = anthywl_graphics_buffer_get(
+        seat->state->wl_shm, &seat->state->buffers,
+        anthywl_ceil(width) * scale, anthywl_ceil(height) * scale);
+    anthywl_metrics_record(ANTHYWL_STAGE_SHM_BUFFER, start);
+    cairo_t *cairo = buffer->cairo;
+    cairo_save(cairo);
+    cairo_scale(cairo, scale, scale);
+    cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_rgba(cairo, 0.0, 0.0, 0.0, 1.0);
+    cairo_paint(cairo);
+    cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
 
-    double x = BORDER + PADDING, y = BORDER + PADDING;
-    double max_text_width = 0.0;
-    cairo_move_to(recording_cairo, x, y);
+    double half_border = BORDER / 2.0;
+    cairo_move_to(cairo, half_border, half_border);
+    cairo_line_to(cairo, width - half_border, half_border);
+    cairo_line_to(cairo, width - half_border, height - half_border);
+    cairo_line_to(cairo, half_border, height - half_border);
+    cairo_line_to(cairo, half_border, half_border);
+    cairo_set_line_width(cairo, BORDER);
+    cairo_set_source_rgba(cairo, 1.0, 1.0, 1.0, 1.0);
+    cairo_stroke(cairo);
+    return buffer;
+}
 
-    pango_layout_set_text(layout, seat->buffer.text, -1);
+struct anthywl_graphics_buffer *anthywl_seat_composing_draw_popup(
+    struct anthywl_seat *seat, int scale)
+{
+    struct anthywl_composer *composer = &seat->composer;
+    size_t cursor_begin = composer->buffer.pos;
+    size_t cursor_end = composer->buffer.pos;
+    char const *text = anthywl_composer_preedit_window(composer,
+        composer->buffer.text, composer->buffer.len,
+        &cursor_begin, &cursor_end);
+    uint64_t start = anthywl_timer_now();
+    PangoLayout *layout = seat->pango_layout;
+    pango_layout_set_text(layout, text, -1);
+    pango_layout_set_attributes(layout, NULL);
     PangoRectangle rect;
     pango_layout_get_extents(layout, NULL, &rect);
     double text_width = (double)rect.width / PANGO_SCALE;
     double text_height = (double)rect.height / PANGO_SCALE;
-    if (text_width > max_text_width) {
-        max_text_width = text_width;
-    }
-    y += text_height;
-    cairo_set_source_rgba(recording_cairo, 1.0, 1.0, 1.0, 1.0);
-    pango_cairo_update_layout(recording_cairo, layout);
-    pango_cairo_show_layout(recording_cairo, layout);
-    cairo_move_to(recording_cairo, x, y);
-
-    x = max_text_width + BORDER * 2.0 + PADDING * 2.0;
-    y += BORDER + PADDING;
-
-    double half_border = BORDER / 2.0;
-    cairo_move_to(recording_cairo, half_border, half_border);
-    cairo_line_to(recording_cairo, x - half_border, half_border);
-    cairo_line_to(recording_cairo, x - half_border, y - half_border);
-    cairo_line_to(recording_cairo, half_border, y - half_border);
-    cairo_line_to(recording_cairo, half_border, half_border);
-    cairo_set_line_width(recording_cairo, BORDER);
-    cairo_set_source_rgba(recording_cairo, 1.0, 1.0, 1.0, 1.0);
-    cairo_stroke(recording_cairo);
-
-    double surface_x, surface_y, surface_width, surface_height;
-    cairo_recording_surface_ink_extents(recording_cairo_surface,
-        &surface_x, &surface_y, &surface_width, &surface_height);
-
-    struct anthywl_graphics_buffer *buffer = anthywl_graphics_buffer_get(
-        seat->state->wl_shm, &seat->state->buffers,
-        surface_width * scale, surface_height * scale);
-    cairo_scale(buffer->cairo, scale, scale);
-    cairo_set_operator(buffer->cairo, CAIRO_OPERATOR_CLEAR);
-    cairo_paint(buffer->cairo);
-    cairo_set_operator(buffer->cairo, CAIRO_OPERATOR_OVER);
-    cairo_set_source_rgba(buffer->cairo, 0.0, 0.0, 0.0, 1.0);
-    cairo_paint(buffer->cairo);
-    cairo_set_source_surface(buffer->cairo, recording_cairo_surface, 0.0, 0.0);
-    cairo_paint(buffer->cairo);
-
+    anthywl_metrics_record(ANTHYWL_STAGE_POPUP_LAYOUT, start);
+
+    struct anthywl_graphics_buffer *buffer = anthywl_seat_begin_draw_popup(
+        seat, text_width + BORDER * 2.0 + PADDING * 2.0,
+        text_height + BORDER * 2.0 + PADDING * 2.0, scale);
+    start = anthywl_timer_now();
+    cairo_move_to(buffer->cairo, BORDER + PADDING, BORDER + PADDING);
+    pango_cairo_show_layout(buffer->cairo, layout);
+    cairo_restore(buffer->cairo);
+    anthywl_metrics_record(ANTHYWL_STAGE_POPUP_RASTER, start);
     return buffer;
 }
 
-struct anthywl_graphics_buffer *anthywl_seat_selecting_draw_popup(
-    struct anthywl_seat *seat, int scale)
+// Measures the selecting popup, and draws its text if cairo isn't NULL.
+// line_y is where the line under the converted text goes, if it's shown.
+static void anthywl_seat_selecting_layout_popup(struct anthywl_seat *seat,
+    cairo_t *cairo, double *width, double *height, double *line_y)
 {
-    cairo_surface_t *recording_cairo_surface =
-        cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, NULL);
-    cairo_t *recording_cairo = cairo_create(recording_cairo_surface);
-    PangoLayout *layout = pango_cairo_create_layout(recording_cairo);
-
+    struct anthywl_composer *composer = &seat->composer;
+    PangoLayout *layout = seat->pango_layout;
+    PangoRectangle rect;
     double x = BORDER + PADDING, y = BORDER + PADDING;
-    double line_y = 0;
     double max_x = 0;
-    cairo_move_to(recording_cairo, x, y);
-
-    if (seat->is_composing_popup_visible) {
-        GString *markup = g_string_new(NULL);
-        for (int i = 0; i < seat->segment_count; i++) {
-            struct anthy_segment_stat segment_stat;
-            anthy_get_segment_stat(seat->anthy_context, i, &segment_stat);
-            char buf[64];
-            anthy_get_segment(seat->anthy_context,
-                i, seat->selected_candidates[i], buf, sizeof buf);
-            char *markup_fragment;
-            if (i == seat->current_segment)
-                markup_fragment = g_markup_printf_escaped("<b>%s</b>", buf);
-            else
-                markup_fragment = g_markup_escape_text(buf, -1);
-            g_string_append(markup, markup_fragment);
-            g_free(markup_fragment);
-        }
-        pango_layout_set_markup(layout, markup->str, -1);
-        g_string_free(markup, TRUE);
+    *line_y = 0;
+
+    if (composer->is_composing_popup_visible) {
+        size_t cursor_begin, cursor_end;
+        char const *text = anthywl_composer_selecting_text(
+            composer, &cursor_begin, &cursor_end);
+        text = anthywl_composer_preedit_window(
+            composer, text, strlen(text), &cursor_begin, &cursor_end);
+        PangoAttrList *attrs = pango_attr_list_new();
+        PangoAttribute *attr = pango_attr_weight_new(PANGO_WEIGHT_BOLD);
+        attr->start_index = cursor_begin;
+        attr->end_index = cursor_end;
+        pango_attr_list_insert(attrs, attr);
+        pango_layout_set_text(layout, text, -1);
+        pango_layout_set_attributes(layout, attrs);
+        pango_attr_list_unref(attrs);
 
-        PangoRectangle rect;
         pango_layout_get_extents(layout, NULL, &rect);
-        max_x = (double)rect.width / PANGO_SCALE > max_x
-            ? (double)rect.width / PANGO_SCALE
-            : max_x;
+        max_x = max(max_x, (double)rect.width / PANGO_SCALE);
+        if (cairo != NULL) {
+            cairo_move_to(cairo, x, y);
+            pango_cairo_show_layout(cairo, layout);
+        }
         y += (double)rect.height / PANGO_SCALE;
-        cairo_set_source_rgba(recording_cairo, 1.0, 1.0, 1.0, 1.0);
-        pango_cairo_update_layout(recording_cairo, layout);
-        pango_cairo_show_layout(recording_cairo, layout);
-        line_y = y + PADDING + BORDER / 2.0;
+        *line_y = y + PADDING + BORDER / 2.0;
         y += BORDER + PADDING * 2.0;
-        cairo_move_to(recording_cairo, x, y);
     }
 
+    struct anthy_segment_stat segment_stat;
+    anthy_get_segment_stat(
+        composer->anthy_context, composer->current_segment, &segment_stat);
+    int selected_candidate =
+        composer->selected_candidates[composer->current_segment];
+    int candidate_offset = selected_candidate / 5 * 5;
+    for (int i = candidate_offset;
+        i < min(candidate_offset + 5, segment_stat.nr_candidate); i++)
     {
-        struct anthy_segment_stat segment_stat;
-        anthy_get_segment_stat(
-            seat->anthy_context, seat->current_segment, &segment_stat);
-        char buf[64];
-        int selected_candidate =
-            seat->selected_candidates[seat->current_segment];
-        int candidate_offset = selected_candidate / 5 * 5;
-        for (int i = candidate_offset;
-            i < min(candidate_offset + 5, segment_stat.nr_candidate); i++)
+        char text[80];
+        int len = snprintf(text, sizeof text, "%d. ", i - candidate_offset + 1);
+        if (anthy_get_segment(composer->anthy_context,
+            composer->current_segment, i, text + len, sizeof text - len) < 0)
         {
-            anthy_get_segment(
-                seat->anthy_context, seat->current_segment, i, buf, sizeof buf);
+            text[len] = '\0';
+        }
+        pango_layout_set_text(layout, text, -1);
+        if (i == selected_candidate) {
             PangoAttrList *attrs = pango_attr_list_new();
-            if (i == selected_candidate) {
-                PangoAttribute *attr = pango_attr_weight_new(PANGO_WEIGHT_BOLD);
-                pango_attr_list_insert(attrs, attr);
-            }
-            char *text;
-            if (asprintf(&text, "%d. %s", i - candidate_offset + 1, buf) < 0) {
-                fprintf(stderr, "Memory allocation failed\n");
-                abort();
-            }
-            pango_layout_set_text(layout, text, -1);
-            free(text);
+            pango_attr_list_insert(
+                attrs, pango_attr_weight_new(PANGO_WEIGHT_BOLD));
             pango_layout_set_attributes(layout, attrs);
+            pango_attr_list_unref(attrs);
+        } else {
+            pango_layout_set_attributes(layout, NULL);
+        }
 
-            PangoRectangle rect;
-            pango_layout_get_extents(layout, NULL, &rect);
-            max_x = (double)rect.width / PANGO_SCALE > max_x
-                ? (double)rect.width / PANGO_SCALE
-                : max_x;
-            y += (double)rect.height / PANGO_SCALE;
-            cairo_set_source_rgba(recording_cairo, 1.0, 1.0, 1.0, 1.0);
-            pango_cairo_update_layout(recording_cairo, layout);
-            pango_cairo_show_layout(recording_cairo, layout);
-            cairo_move_to(recording_cairo, x, y);
+        pango_layout_get_extents(layout, NULL, &rect);
+        max_x = max(max_x, (double)rect.width / PANGO_SCALE);
+        if (cairo != NULL) {
+            cairo_move_to(cairo, x, y);
+            pango_cairo_show_layout(cairo, layout);
         }
+        y += (double)rect.height / PANGO_SCALE;
     }
 
-    max_x += BORDER * 2.0 + PADDING * 2.0;
-    y += BORDER + PADDING;
-
-    double half_border = BORDER / 2.0;
+    *width = max_x + BORDER * 2.0 + PADDING * 2.0;
+    *height = y + BORDER + PADDING;
+}
 
-    if (seat->is_composing_popup_visible) {
-        cairo_move_to(recording_cairo, half_border, line_y);
-        cairo_line_to(recording_cairo, max_x, line_y);
-        cairo_set_line_width(recording_cairo, BORDER);
-        cairo_set_source_rgba(recording_cairo, 1.0, 1.0, 1.0, 1.0);
-        cairo_stroke(recording_cairo);
+struct anthywl_graphics_buffer *anthywl_seat_selecting_draw_popup(
+    struct anthywl_seat *seat, int scale)
+{
+    double width, height, line_y;
+    uint64_t start = anthywl_timer_now();
+    anthywl_seat_selecting_layout_popup(seat, NULL, &width, &height, &line_y);
+    anthywl_metrics_record(ANTHYWL_STAGE_POPUP_LAYOUT, start);
+
+    struct anthywl_graphics_buffer *buffer =
+        anthywl_seat_begin_draw_popup(seat, width, height, scale);
+    start = anthywl_timer_now();
+    anthywl_seat_selecting_layout_popup(
+        seat, buffer->cairo, &width, &height, &line_y);
+    if (seat->composer.is_composing_popup_visible) {
+        cairo_move_to(buffer->cairo, BORDER / 2.0, line_y);
+        cairo_line_to(buffer->cairo, width, line_y);
+        cairo_stroke(buffer->cairo);
     }
-
-    cairo_move_to(recording_cairo, half_border, half_border);
-    cairo_line_to(recording_cairo, max_x - half_border, half_border);
-    cairo_line_to(recording_cairo, max_x - half_border, y - half_border);
-    cairo_line_to(recording_cairo, half_border, y - half_border);
-    cairo_line_to(recording_cairo, half_border, half_border);
-    cairo_set_line_width(recording_cairo, BORDER);
-    cairo_set_source_rgba(recording_cairo, 1.0, 1.0, 1.0, 1.0);
-    cairo_stroke(recording_cairo);
-
-    double surface_x, surface_y, surface_width, surface_height;
-    cairo_recording_surface_ink_extents(recording_cairo_surface,
-        &surface_x, &surface_y, &surface_width, &surface_height);
-
-    struct anthywl_graphics_buffer *buffer = anthywl_graphics_buffer_get(
-        seat->state->wl_shm, &seat->state->buffers,
-        surface_width * scale, surface_height * scale);
-    cairo_scale(buffer->cairo, scale, scale);
-    cairo_set_operator(buffer->cairo, CAIRO_OPERATOR_CLEAR);
-    cairo_paint(buffer->cairo);
-    cairo_set_operator(buffer->cairo, CAIRO_OPERATOR_OVER);
-    cairo_set_source_rgba(buffer->cairo, 0.0, 0.0, 0.0, 1.0);
-    cairo_paint(buffer->cairo);
-    cairo_set_source_surface(buffer->cairo, recording_cairo_surface, 0.0, 0.0);
-    cairo_paint(buffer->cairo);
-
+    cairo_restore(buffer->cairo);
+    anthywl_metrics_record(ANTHYWL_STAGE_POPUP_RASTER, start);
     return buffer;
 }
 
 void anthywl_seat_draw_popup(struct anthywl_seat *seat) {
+#ifdef ANTHYWL_IPC_SUPPORT
+    anthywl_ipc_seat_changed(&seat->state->ipc, seat);
+#endif
+
+    ANTHYWL_TRACE_BEGIN("anthywl_seat_draw_popup");
     int scale = seat->scale != 0 ? seat->scale : seat->state->max_scale;
 
     struct anthywl_graphics_buffer *buffer = NULL;
-    if (seat->is_selecting && seat->is_selecting_popup_visible) {
+    struct anthywl_composer *composer = &seat->composer;
+    if (composer->is_selecting && composer->is_selecting_popup_visible) {
         buffer = anthywl_seat_selecting_draw_popup(seat, scale);
-    } else if (seat->is_composing
-        && seat->buffer.len != 0
-        && seat->is_composing_popup_visible)
+    } else if (composer->is_composing
+        && composer->buffer.len != 0
+        && composer->is_composing_popup_visible)
     {
         buffer = anthywl_seat_composing_draw_popup(seat, scale);
     }
 
-    if (buffer) {
-        wl_surface_attach(seat->wl_surface, buffer->wl_buffer, 0, 0);
-        wl_surface_damage_buffer(seat->wl_surface, 0, 0,
-            buffer->width, buffer->height);
-        wl_surface_set_buffer_scale(seat->wl_surface, scale);
-    } else {
-        wl_surface_attach(seat->wl_surface, NULL, 0, 0);
-    }
-
-    wl_surface_commit(seat->wl_surface);
+    if (buffer)
+        anthywl_metrics.counters[ANTHYWL_COUNTER_POPUP_DRAWS] += 1;
+    composer->sink->show_popup(seat, buffer, scale);
+    ANTHYWL_TRACE_END("anthywl_seat_draw_popup");
 }
 
 void anthywl_seat_init(struct anthywl_seat *seat,
     struct anthywl_state *state, struct wl_seat *wl_seat)
 {
     seat->state = state;
+    anthywl_composer_init(&seat->composer, &anthywl_wayland_sink);
+    // Batches the state has begun are ended for every seat.
+    seat->composer.batch_depth = state->batch_depth;
     seat->wl_seat = wl_seat;
-    wl_seat_add_listener(wl_seat, &wl_seat_listener, seat);
-    seat->xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    seat->record_index = state->recorder.seats++;
+    if (wl_seat != NULL)
+        wl_seat_add_listener(wl_seat, &wl_seat_listener, seat);
     seat->cursor_timer.callback = anthywl_seat_cursor_timer_callback;
     wl_array_init(&seat->outputs);
     if (state->running)
         anthywl_seat_init_protocols(seat);
-    anthywl_buffer_init(&seat->buffer);
-    seat->anthy_context = anthy_create_context();
-    anthy_context_set_encoding(seat->anthy_context, ANTHY_UTF8_ENCODING);
+    seat->pango_context = pango_font_map_create_context(
+        pango_cairo_font_map_get_default());
+    seat->pango_layout = pango_layout_new(seat->pango_context);
+    anthywl_fallback_keymap_init(&seat->fallback_keymap);
+    anthywl_array_init(&seat->fallback_keys);
     seat->repeat_timer.callback = anthywl_seat_repeat_timer_callback;
-    seat->is_composing = state->config.active_at_startup;
+    seat->composer.is_composing = state->config.active_at_startup;
 }
 
 void wl_surface_enter(void *data, struct wl_surface *wl_surface,
@@ -349,30 +335,37 @@ void anthywl_seat_init_protocols(struct anthywl_seat *seat) {
         &zwp_input_method_keyboard_grab_v2_listener, seat);
     seat->wl_surface = wl_compositor_create_surface(seat->state->wl_compositor);
     wl_surface_add_listener(seat->wl_surface, &wl_surface_listener, seat);
-    anthywl_seat_draw_popup(seat);
+    anthywl_composer_update_popup(&seat->composer);
     seat->zwp_input_popup_surface_v2 =
         zwp_input_method_v2_get_input_popup_surface(
             seat->zwp_input_method_v2, seat->wl_surface);
     zwp_input_popup_surface_v2_add_listener(seat->zwp_input_popup_surface_v2,
         &zwp_input_popup_surface_v2_listener, seat);
-    seat->wl_surface_cursor =
-        wl_compositor_create_surface(seat->state->wl_compositor);
-    wl_surface_add_listener(
-        seat->wl_surface_cursor, &wl_surface_listener, seat);
+    if (seat->state->wp_cursor_shape_manager_v1 == NULL) {
+        seat->wl_surface_cursor =
+            wl_compositor_create_surface(seat->state->wl_compositor);
+        wl_surface_add_listener(
+            seat->wl_surface_cursor, &wl_surface_listener, seat);
+    }
     seat->are_protocols_initted = true;
 }
 
 void anthywl_seat_destroy(struct anthywl_seat *seat) {
-    anthy_release_context(seat->anthy_context);
-    free(seat->selected_candidates);
-    anthywl_buffer_destroy(&seat->buffer);
-    free(seat->pending_surrounding_text);
-    free(seat->surrounding_text);
+#ifdef ANTHYWL_IPC_SUPPORT
+    anthywl_ipc_seat_destroyed(&seat->state->ipc, seat);
+#endif
+    anthywl_timer_cancel(&seat->state->timers, &seat->repeat_timer);
+    anthywl_timer_cancel(&seat->state->timers, &seat->cursor_timer);
+    anthywl_composer_finish(&seat->composer);
+    g_object_unref(seat->pango_layout);
+    g_object_unref(seat->pango_context);
+    anthywl_array_release(&seat->fallback_keys);
+    free(seat->pending_surrounding_text.text);
     free(seat->name);
     xkb_state_unref(seat->xkb_state);
-    xkb_keymap_unref(seat->xkb_keymap);
-    xkb_context_unref(seat->xkb_context);
-    free(seat->xkb_keymap_string);
+    anthywl_keymap_unref(seat->keymap);
+    if (seat->wp_cursor_shape_device_v1 != NULL)
+        wp_cursor_shape_device_v1_destroy(seat->wp_cursor_shape_device_v1);
     if (seat->are_protocols_initted) {
         zwp_input_popup_surface_v2_destroy(seat->zwp_input_popup_surface_v2);
         wl_surface_destroy(seat->wl_surface);
@@ -382,200 +375,80 @@ void anthywl_seat_destroy(struct anthywl_seat *seat) {
             seat->zwp_input_method_keyboard_grab_v2);
         zwp_input_method_v2_destroy(seat->zwp_input_method_v2);
     }
-    wl_seat_destroy(seat->wl_seat);
+    if (seat->wl_seat != NULL)
+        wl_seat_destroy(seat->wl_seat);
     wl_list_remove(&seat->link);
     free(seat);
 }
 
-void anthywl_seat_composing_update(struct anthywl_seat *seat) {
-    zwp_input_method_v2_set_preedit_string(
-        seat->zwp_input_method_v2, seat->buffer.text,
-        seat->buffer.pos, seat->buffer.pos);
-    zwp_input_method_v2_commit(
-        seat->zwp_input_method_v2, seat->done_events_received);
-    anthywl_seat_draw_popup(seat);
-}
-
-bool anthywl_seat_send_string(struct anthywl_seat *seat, const char *text) {
-    if (!seat->active) {
-        int keymap_fd;
-        uint32_t *keys;
-        size_t keymap_size, keys_size;
-        if (!anthywl_make_keymap(
-            text, &keymap_fd, &keymap_size, &keys, &keys_size))
-        {
+// Types text through a keymap made for it, for when no text input is
+// active. Text with more distinct characters than a keymap can hold is
+// typed in chunks, each with its own keymap.
+bool anthywl_seat_type_string(struct anthywl_seat *seat, char const *text) {
+    while (*text != '\0') {
+        size_t len = anthywl_fallback_keymap_add_text(
+            &seat->fallback_keymap, text, &seat->fallback_keys);
+        if (len == 0)
             return false;
+        text += len;
+        if (seat->fallback_keymap.dirty) {
+            int keymap_fd;
+            size_t keymap_size;
+            if (!anthywl_fallback_keymap_write(
+                &seat->fallback_keymap, &keymap_fd, &keymap_size))
+            {
+                return false;
+            }
+            seat->composer.sink->type_keymap(seat,
+                WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, keymap_fd, keymap_size);
+            close(keymap_fd);
         }
-        zwp_virtual_keyboard_v1_keymap(
-            seat->zwp_virtual_keyboard_v1_backup_input,
-            WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, keymap_fd, keymap_size);
-        for (size_t i = 0; i < keys_size; i++) {
-            zwp_virtual_keyboard_v1_key(
-                seat->zwp_virtual_keyboard_v1_backup_input,
-                0, keys[i], WL_KEYBOARD_KEY_STATE_PRESSED);
-            zwp_virtual_keyboard_v1_key(
-                seat->zwp_virtual_keyboard_v1_backup_input,
-                0, keys[i], WL_KEYBOARD_KEY_STATE_RELEASED);
+        uint32_t *key;
+        anthywl_array_for_each(key, &seat->fallback_keys) {
+            seat->composer.sink->type_key(
+                seat, *key, WL_KEYBOARD_KEY_STATE_PRESSED);
+            seat->composer.sink->type_key(
+                seat, *key, WL_KEYBOARD_KEY_STATE_RELEASED);
         }
-        free(keys);
-        return true;
+        // Don't let the keymap fds of a long paste pile up unsent.
+        if (*text != '\0')
+            seat->composer.sink->flush(seat);
     }
-    zwp_input_method_v2_commit_string(seat->zwp_input_method_v2, text);
-    zwp_input_method_v2_commit(
-        seat->zwp_input_method_v2, seat->done_events_received);
     return true;
 }
 
-void anthywl_seat_composing_commit(struct anthywl_seat *seat) {
-    anthywl_seat_send_string(seat, seat->buffer.text);
-    anthywl_buffer_clear(&seat->buffer);
-    anthywl_seat_draw_popup(seat);
-}
-
-void anthywl_seat_selecting_update(struct anthywl_seat *seat) {
-    size_t cursor_begin = 0, cursor_end = 0;
-    struct wl_array buffer;
-    wl_array_init(&buffer);
-
-    for (int i = 0; i < seat->segment_count; i++) {
-        struct anthy_segment_stat segment_stat;
-        anthy_get_segment_stat(seat->anthy_context, i, &segment_stat);
-        char buf[64];
-        anthy_get_segment(seat->anthy_context, i, seat->selected_candidates[i],
-            buf, sizeof buf);
-        if (i == seat->current_segment)
-            cursor_begin = buffer.size;
-        size_t buf_len = strlen(buf);
-        wl_array_add(&buffer, buf_len);
-        memcpy(buffer.data + buffer.size - buf_len, buf, buf_len);
-        if (i == seat->current_segment)
-            cursor_end = buffer.size;
-    }
-
-    wl_array_add(&buffer, 1);
-    ((char *)buffer.data)[buffer.size - 1] = 0;
-
-    zwp_input_method_v2_set_preedit_string(
-        seat->zwp_input_method_v2, buffer.data, cursor_begin, cursor_end);
-    zwp_input_method_v2_commit(
-        seat->zwp_input_method_v2, seat->done_events_received);
-
-    anthywl_seat_draw_popup(seat);
-
-    wl_array_release(&buffer);
-}
-
-void anthywl_seat_selecting_commit(struct anthywl_seat *seat) {
-    struct wl_array buffer;
-    wl_array_init(&buffer);
-
-    char buf[64];
-    for (int i = 0; i < seat->segment_count; i++) {
-        struct anthy_segment_stat segment_stat;
-        anthy_get_segment_stat(seat->anthy_context, i, &segment_stat);
-        anthy_get_segment(seat->anthy_context,
-            i, seat->selected_candidates[i], buf, sizeof buf);
-        size_t buf_len = strlen(buf);
-        wl_array_add(&buffer, buf_len);
-        memcpy(buffer.data + buffer.size - buf_len, buf, buf_len);
-    }
-
-    wl_array_add(&buffer, 1);
-    ((char *)buffer.data)[buffer.size - 1] = 0;
-
-    anthywl_seat_send_string(seat, buffer.data);
-    seat->is_selecting = false;
-    seat->is_selecting_popup_visible = false;
-    anthywl_buffer_clear(&seat->buffer);
-
-    anthywl_seat_draw_popup(seat);
-
-    wl_array_release(&buffer);
-}
-
-int anthywl_binding_compare(void const *_a, void const *_b) {
-    const struct anthywl_binding *a = _a;
-    const struct anthywl_binding *b = _b;
-    int keysym = a->keysym - b->keysym;
-    if (keysym != 0)
-        return keysym;
-    int modifiers = a->modifiers - b->modifiers;
-    if (modifiers != 0)
-        return modifiers;
-    return a->action - b->action;
-}
-
-int anthywl_seat_binding_compare(void const *_a, void const *_b) {
-    const struct anthywl_seat_binding *a = _a;
-    const struct anthywl_seat_binding *b = _b;
-    int keycode = a->keycode - b->keycode;
-    if (keycode != 0)
-        return keycode;
-    int mod_mask = a->mod_mask - b->mod_mask;
-    if (mod_mask != 0)
-        return mod_mask;
-    return a->action - b->action;
-}
-
-int anthywl_seat_binding_compare_without_action(
-    void const *_a, void const *_b)
-{
-    const struct anthywl_seat_binding *a = _a;
-    const struct anthywl_seat_binding *b = _b;
-    int keycode = a->keycode - b->keycode;
-    if (keycode != 0)
-        return keycode;
-    return a->mod_mask - b->mod_mask;
-}
-
-
 bool anthywl_seat_handle_key_bindings(struct anthywl_seat *seat,
-    struct wl_array *bindings, struct anthywl_seat_binding *press)
+    struct anthywl_seat_bindings *bindings,
+    xkb_keycode_t keycode, xkb_mod_mask_t mod_mask)
 {
-    struct anthywl_seat_binding *found = bsearch(press, bindings->data,
-        bindings->size / sizeof(struct anthywl_seat_binding),
-        sizeof(struct anthywl_seat_binding),
-        anthywl_seat_binding_compare_without_action);
-    if (found == NULL)
+    uint64_t start = anthywl_timer_now();
+    enum anthywl_action action =
+        anthywl_seat_bindings_find(bindings, keycode, mod_mask);
+    anthywl_metrics_record(ANTHYWL_STAGE_BINDING_LOOKUP, start);
+    if (action == ANTHYWL_ACTION_INVALID)
         return false;
-    return anthywl_seat_handle_action(seat, found->action);
+    return anthywl_composer_handle_action(&seat->composer, action);
 }
 
-bool anthywl_seat_handle_key(struct anthywl_seat *seat,
+static bool anthywl_seat_process_key(struct anthywl_seat *seat,
     xkb_keycode_t keycode)
 {
     xkb_keysym_t keysym = xkb_state_key_get_one_sym(seat->xkb_state, keycode);
-    struct anthywl_seat_binding press = {
-        .keycode = keycode,
-        .mod_mask = 0,
-        .action = 0,
-    };
-    xkb_mod_mask_t mod_count = xkb_keymap_num_mods(seat->xkb_keymap);
-    for (xkb_mod_index_t i = 0; i < mod_count; i++) {
-        bool is_active = xkb_state_mod_index_is_active(seat->xkb_state,
-            i, XKB_STATE_MODS_EFFECTIVE);
-        bool is_consumed = xkb_state_mod_index_is_consumed(seat->xkb_state,
-            keycode, i);
-        bool is_relevant = (i != seat->mod_indices[ANTHYWL_CAPS_INDEX])
-            && (i != seat->mod_indices[ANTHYWL_NUM_INDEX]);
-        (void)is_consumed;
-        if (is_active && is_relevant)
-            press.mod_mask |= 1 << i;
-    }
+    xkb_mod_mask_t mod_mask = seat->active_binding_mods;
 handle:
-    if (seat->is_selecting && anthywl_seat_handle_key_bindings(
-        seat, &seat->selecting_bindings, &press))
+    if (seat->composer.is_selecting && anthywl_seat_handle_key_bindings(
+        seat, &seat->keymap->selecting_bindings, keycode, mod_mask))
     {
         return true;
     }
-    if (seat->is_composing && seat->buffer.len != 0
+    if (seat->composer.is_composing && seat->composer.buffer.len != 0
         && anthywl_seat_handle_key_bindings(
-        seat, &seat->composing_bindings, &press))
+        seat, &seat->keymap->composing_bindings, keycode, mod_mask))
     {
         return true;
     }
     if (anthywl_seat_handle_key_bindings(
-        seat, &seat->global_bindings, &press))
+        seat, &seat->keymap->global_bindings, keycode, mod_mask))
     {
         return true;
     }
@@ -592,109 +465,106 @@ handle:
     {
         return false;
     }
-    if (seat->is_selecting) {
-        anthywl_seat_selecting_commit(seat);
+    if (seat->composer.is_selecting) {
+        anthywl_composer_selecting_commit(&seat->composer);
         goto handle;
     }
-    if (seat->is_composing && keysym != XKB_KEY_space) {
+    if (seat->composer.is_composing && keysym != XKB_KEY_space) {
         uint32_t codepoint = xkb_state_key_get_utf32(seat->xkb_state, keycode);
         if (codepoint != 0 && codepoint < 32)
             return false;
         int utf8_len = xkb_state_key_get_utf8(seat->xkb_state, keycode, NULL, 0);
         if (utf8_len == 0)
             return false;
-        char *utf8 = malloc(utf8_len + 1);
+        char *utf8 = anthywl_arena_alloc(&seat->composer.arena, utf8_len + 1);
         xkb_state_key_get_utf8(seat->xkb_state, keycode, utf8, utf8_len + 1);
-        anthywl_buffer_append(&seat->buffer, utf8);
-        anthywl_buffer_convert_romaji(&seat->buffer);
-        anthywl_seat_composing_update(seat);
-        free(utf8);
+        uint64_t start = anthywl_timer_now();
+        anthywl_buffer_append(&seat->composer.buffer, utf8);
+        anthywl_buffer_convert_romaji(&seat->composer.buffer);
+        if (seat->composer.input_mode == ANTHYWL_INPUT_MODE_KATAKANA)
+            anthywl_buffer_convert_katakana(&seat->composer.buffer);
+        anthywl_metrics_record(ANTHYWL_STAGE_ROMAJI, start);
+        anthywl_composer_composing_update(&seat->composer);
         return true;
     }
 
     return false;
 }
 
-static void timespec_correct(struct timespec *ts) {
-    while (ts->tv_nsec >= 1000000000) {
-        ts->tv_sec += 1;
-        ts->tv_nsec -= 1000000000;
-    }
+bool anthywl_seat_handle_key(struct anthywl_seat *seat,
+    xkb_keycode_t keycode)
+{
+    anthywl_metrics.counters[ANTHYWL_COUNTER_KEYS] += 1;
+    bool timed = seat->composer.key_time == 0;
+    if (timed)
+        seat->composer.key_time = anthywl_timer_now();
+    ANTHYWL_TRACE_BEGIN("anthywl_seat_handle_key");
+    bool handled = anthywl_seat_process_key(seat, keycode);
+    ANTHYWL_TRACE_END("anthywl_seat_handle_key");
+    // Keys passed on to the client don't lead to a commit of ours.
+    if (!handled && timed)
+        seat->composer.key_time = 0;
+    return handled;
+}
+
+static void anthywl_seat_start_repeat(struct anthywl_seat *seat,
+    xkb_keycode_t keycode, uint32_t time)
+{
+    seat->repeating_keycode = keycode;
+    seat->repeating_timestamp = time + seat->repeat_delay;
+    seat->repeat_start =
+        anthywl_timer_now() + seat->repeat_delay * UINT64_C(1000000);
+    seat->repeat_count = 0;
+    anthywl_timer_arm(
+        &seat->state->timers, &seat->repeat_timer, seat->repeat_start);
 }
 
+// A gap this long between repeat ticks comes from a suspend or a stopped
+// process rather than a busy loop. Catching up on it would type a burst of
+// characters the user never saw being held, so its ticks are dropped.
+#define REPEAT_GAP_MAX_NS UINT64_C(1000000000)
+
 void anthywl_seat_repeat_timer_callback(struct anthywl_timer *timer) {
     struct anthywl_seat *seat = wl_container_of(timer, seat, repeat_timer);
     if (seat->repeat_rate <= 0) {
-        wl_list_remove(&timer->link);
         seat->repeating_keycode = 0;
         return;
     }
-    seat->repeating_timestamp += 1000 / seat->repeat_rate;
-    if (!anthywl_seat_handle_key(seat, seat->repeating_keycode)) {
-        wl_list_remove(&timer->link);
-        zwp_virtual_keyboard_v1_key(
-            seat->zwp_virtual_keyboard_v1_passthrough, seat->repeating_timestamp,
-            seat->repeating_keycode - 8, WL_KEYBOARD_KEY_STATE_PRESSED);
-        seat->repeating_keycode = 0;
-    } else {
-        clock_gettime(CLOCK_MONOTONIC, &seat->repeat_timer.time);
-        timer->time.tv_nsec += 1000000000 / seat->repeat_rate;
-        timespec_correct(&timer->time);
-    }
-}
-
-struct keycode_matches {
-    struct anthywl_seat *seat;
-    xkb_keysym_t keysym;
-    struct wl_array keycodes;
-};
 
-static void find_keycode(struct xkb_keymap *keymap, xkb_keycode_t keycode,
-    void *data)
-{
-    struct keycode_matches *matches = data;
-    xkb_keysym_t keysym = xkb_state_key_get_one_sym(
-        matches->seat->xkb_state, keycode);
-    if (keysym == XKB_KEY_NoSymbol)
-        return;
-    if (matches->keysym == keysym) {
-        xkb_keycode_t *keycode_spot =
-            wl_array_add(&matches->keycodes, sizeof(xkb_keycode_t));
-        *keycode_spot = keycode;
+    // Deadlines are derived from the time of the first repeat rather than
+    // from when the callback ran, so loop latency doesn't accumulate. Ticks
+    // missed while the loop was busy, as during a slow conversion, are all
+    // handled together, with a single preedit and popup update at the end.
+    uint64_t period = 1000000000 / seat->repeat_rate;
+    uint64_t now = anthywl_timer_now();
+    uint64_t due = (now - seat->repeat_start) / period + 1;
+    uint64_t deadline = seat->repeat_start + seat->repeat_count * period;
+    if (now > deadline + REPEAT_GAP_MAX_NS) {
+        uint64_t skipped = due - seat->repeat_count - 1;
+        seat->repeating_timestamp += skipped * (1000 / seat->repeat_rate);
+        seat->repeat_start = now;
+        seat->repeat_count = 0;
+        due = 1;
     }
-}
+    bool handled = true;
+    anthywl_composer_begin_batch(&seat->composer);
+    while (seat->repeat_count < due) {
+        seat->repeat_count += 1;
+        seat->repeating_timestamp += 1000 / seat->repeat_rate;
+        handled = anthywl_seat_handle_key(seat, seat->repeating_keycode);
+        if (!handled)
+            break;
+    }
+    anthywl_composer_end_batch(&seat->composer);
 
-void anthywl_seat_set_up_bindings(struct anthywl_seat *seat,
-    struct wl_array *state_bindings, struct wl_array *seat_bindings)
-{
-    struct anthywl_binding *state_binding;
-    struct keycode_matches matches = {
-        .seat = seat,
-    };
-    wl_array_init(&matches.keycodes);
-    wl_array_for_each(state_binding, state_bindings) {
-        matches.keysym = state_binding->keysym;
-        matches.keycodes.size = 0;
-        xkb_keymap_key_for_each(seat->xkb_keymap, find_keycode, &matches);
-        xkb_mod_mask_t mod_mask = 0;
-        for (int i = 0; i < _ANTHYWL_MOD_LAST; i++) {
-            if (state_binding->modifiers & (1 << i)) {
-                mod_mask |= 1 << seat->mod_indices[i];
-            }
-        }
-        xkb_keycode_t *keycode;
-        wl_array_for_each(keycode, &matches.keycodes) {
-            struct anthywl_seat_binding *seat_binding = wl_array_add(
-                seat_bindings, sizeof(struct anthywl_seat_binding));
-            seat_binding->keycode = *keycode;
-            seat_binding->mod_mask = mod_mask;
-            seat_binding->action = state_binding->action;
-        }
+    if (!handled) {
+        seat->composer.sink->forward_key(seat, seat->repeating_timestamp,
+            seat->repeating_keycode - 8, WL_KEYBOARD_KEY_STATE_PRESSED);
+        seat->repeating_keycode = 0;
+    } else {
+        anthywl_timer_arm(&seat->state->timers, timer,
+            seat->repeat_start + seat->repeat_count * period);
     }
-    qsort(seat_bindings->data,
-        seat_bindings->size / sizeof(struct anthywl_seat_binding),
-        sizeof(struct anthywl_seat_binding), anthywl_seat_binding_compare);
-    wl_array_release(&matches.keycodes);
 }
 
 void zwp_input_method_keyboard_grab_v2_keymap(void *data,
@@ -703,40 +573,24 @@ void zwp_input_method_keyboard_grab_v2_keymap(void *data,
 {
     struct anthywl_seat *seat = data;
     char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (seat->xkb_keymap_string == NULL
-        || strcmp(seat->xkb_keymap_string, map) != 0)
-    {
-        zwp_virtual_keyboard_v1_keymap(
-            seat->zwp_virtual_keyboard_v1_passthrough, format, fd, size);
-        xkb_keymap_unref(seat->xkb_keymap);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return;
+    }
+    size_t len = strnlen(map, size);
+    anthywl_recorder_write(&seat->state->recorder, seat->record_index,
+        ANTHYWL_RECORD_KEYMAP, &format, 1, map, len);
+    struct anthywl_keymap *keymap = anthywl_keymap_get(seat->state, map, len);
+    if (keymap != NULL && keymap != seat->keymap) {
+        seat->composer.sink->forward_keymap(seat, format, fd, size);
+        anthywl_keymap_unref(seat->keymap);
+        seat->keymap = keymap;
         xkb_state_unref(seat->xkb_state);
-        seat->xkb_keymap = xkb_keymap_new_from_string(seat->xkb_context, map,
-            XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
-        seat->mod_indices[ANTHYWL_SHIFT_INDEX] = xkb_keymap_mod_get_index(
-            seat->xkb_keymap, XKB_MOD_NAME_SHIFT);
-        seat->mod_indices[ANTHYWL_CAPS_INDEX] = xkb_keymap_mod_get_index(
-            seat->xkb_keymap, XKB_MOD_NAME_CAPS);
-        seat->mod_indices[ANTHYWL_CTRL_INDEX] = xkb_keymap_mod_get_index(
-            seat->xkb_keymap, XKB_MOD_NAME_CTRL);
-        seat->mod_indices[ANTHYWL_ALT_INDEX] = xkb_keymap_mod_get_index(
-            seat->xkb_keymap, XKB_MOD_NAME_ALT);
-        seat->mod_indices[ANTHYWL_NUM_INDEX] = xkb_keymap_mod_get_index(
-            seat->xkb_keymap, XKB_MOD_NAME_NUM);
-        seat->mod_indices[ANTHYWL_MOD3_INDEX] = xkb_keymap_mod_get_index(
-            seat->xkb_keymap, "Mod3");
-        seat->mod_indices[ANTHYWL_LOGO_INDEX] = xkb_keymap_mod_get_index(
-            seat->xkb_keymap, XKB_MOD_NAME_LOGO);
-        seat->mod_indices[ANTHYWL_MOD5_INDEX] = xkb_keymap_mod_get_index(
-            seat->xkb_keymap, "Mod5");
-        seat->xkb_state = xkb_state_new(seat->xkb_keymap);
-        free(seat->xkb_keymap_string);
-        seat->xkb_keymap_string = strdup(map);
-        anthywl_seat_set_up_bindings(seat,
-            &seat->state->config.global_bindings, &seat->global_bindings);
-        anthywl_seat_set_up_bindings(seat,
-            &seat->state->config.selecting_bindings, &seat->selecting_bindings);
-        anthywl_seat_set_up_bindings(seat,
-            &seat->state->config.composing_bindings, &seat->composing_bindings);
+        seat->xkb_state = xkb_state_new(keymap->xkb_keymap);
+        seat->active_binding_mods = 0;
+    } else {
+        anthywl_keymap_unref(keymap);
     }
     close(fd);
     munmap(map, size);
@@ -749,6 +603,17 @@ void zwp_input_method_keyboard_grab_v2_key(void *data,
     struct anthywl_seat *seat = data;
     xkb_keycode_t keycode = key + 8;
     bool handled = false;
+    anthywl_recorder_write(&seat->state->recorder, seat->record_index,
+        ANTHYWL_RECORD_KEY, (uint32_t[]){ time, key, state }, 3, NULL, 0);
+
+    // Fields like passwords get keys exactly as typed, without looking at
+    // bindings or the keymap.
+    if (state == WL_KEYBOARD_KEY_STATE_PRESSED
+        && seat->composer.input_mode == ANTHYWL_INPUT_MODE_PASSTHROUGH
+        && seat->repeating_keycode == 0)
+    {
+        goto forward;
+    }
 
     if (state == WL_KEYBOARD_KEY_STATE_PRESSED
         && seat->repeating_keycode != 0
@@ -756,17 +621,14 @@ void zwp_input_method_keyboard_grab_v2_key(void *data,
     {
         if (!anthywl_seat_handle_key(seat, keycode)) {
             seat->repeating_keycode = 0;
-            wl_list_remove(&seat->repeat_timer.link);
+            anthywl_timer_cancel(&seat->state->timers, &seat->repeat_timer);
             goto forward;
         }
-        if (xkb_keymap_key_repeats(seat->xkb_keymap, keycode)) {
-            seat->repeating_keycode = keycode;
-            seat->repeating_timestamp = time + seat->repeat_delay;
-            clock_gettime(CLOCK_MONOTONIC, &seat->repeat_timer.time);
-            seat->repeat_timer.time.tv_nsec += seat->repeat_delay * 1000000;
-            timespec_correct(&seat->repeat_timer.time);
+        if (xkb_keymap_key_repeats(seat->keymap->xkb_keymap, keycode)) {
+            anthywl_seat_start_repeat(seat, keycode, time);
         } else {
             seat->repeating_keycode = 0;
+            anthywl_timer_cancel(&seat->state->timers, &seat->repeat_timer);
         }
         return;
     }
@@ -775,7 +637,7 @@ void zwp_input_method_keyboard_grab_v2_key(void *data,
         && seat->repeating_keycode == keycode)
     {
         seat->repeating_keycode = 0;
-        wl_list_remove(&seat->repeat_timer.link);
+        anthywl_timer_cancel(&seat->state->timers, &seat->repeat_timer);
         return;
     }
 
@@ -783,17 +645,12 @@ void zwp_input_method_keyboard_grab_v2_key(void *data,
         handled |= anthywl_seat_handle_key(seat, keycode);
 
     if (state == WL_KEYBOARD_KEY_STATE_PRESSED
-        && xkb_keymap_key_repeats(seat->xkb_keymap, keycode)
+        && xkb_keymap_key_repeats(seat->keymap->xkb_keymap, keycode)
         && handled)
     {
         if (seat->repeat_rate <= 0)
             return;
-        seat->repeating_keycode = keycode;
-        seat->repeating_timestamp = time + seat->repeat_delay;
-        clock_gettime(CLOCK_MONOTONIC, &seat->repeat_timer.time);
-        seat->repeat_timer.time.tv_nsec += seat->repeat_delay * 1000000;
-        timespec_correct(&seat->repeat_timer.time);
-        wl_list_insert(&seat->state->timers, &seat->repeat_timer.link);
+        anthywl_seat_start_repeat(seat, keycode, time);
         return;
     }
 
@@ -823,8 +680,7 @@ void zwp_input_method_keyboard_grab_v2_key(void *data,
         return;
 
 forward:
-    zwp_virtual_keyboard_v1_key(
-        seat->zwp_virtual_keyboard_v1_passthrough, time, key, state);
+    seat->composer.sink->forward_key(seat, time, key, state);
 }
 
 void zwp_input_method_keyboard_grab_v2_modifiers(void *data,
@@ -834,10 +690,16 @@ void zwp_input_method_keyboard_grab_v2_modifiers(void *data,
     uint32_t group)
 {
     struct anthywl_seat *seat = data;
+    anthywl_recorder_write(&seat->state->recorder, seat->record_index,
+        ANTHYWL_RECORD_MODIFIERS,
+        (uint32_t[]){ mods_depressed, mods_latched, mods_locked, group }, 4,
+        NULL, 0);
     xkb_state_update_mask(seat->xkb_state,
         mods_depressed, mods_latched, mods_locked, 0, 0, group);
-    zwp_virtual_keyboard_v1_modifiers(seat->zwp_virtual_keyboard_v1_passthrough,
-        mods_depressed, mods_latched, mods_locked, group);
+    seat->active_binding_mods = xkb_state_serialize_mods(
+        seat->xkb_state, XKB_STATE_MODS_EFFECTIVE) & seat->keymap->binding_mods;
+    seat->composer.sink->forward_modifiers(
+        seat, mods_depressed, mods_latched, mods_locked, group);
 }
 
 void zwp_input_method_keyboard_grab_v2_repeat_info(void *data,
@@ -845,6 +707,8 @@ void zwp_input_method_keyboard_grab_v2_repeat_info(void *data,
     int32_t rate, int32_t delay)
 {
     struct anthywl_seat *seat = data;
+    anthywl_recorder_write(&seat->state->recorder, seat->record_index,
+        ANTHYWL_RECORD_REPEAT_INFO, (uint32_t[]){ rate, delay }, 2, NULL, 0);
     seat->repeat_rate = rate;
     seat->repeat_delay = delay;
 }
@@ -853,9 +717,10 @@ void zwp_input_method_v2_activate(
     void *data, struct zwp_input_method_v2 *zwp_input_method_v2)
 {
     struct anthywl_seat *seat = data;
+    anthywl_recorder_write(&seat->state->recorder, seat->record_index,
+        ANTHYWL_RECORD_ACTIVATE, NULL, 0, NULL, 0);
     seat->pending_activate = true;
-    free(seat->pending_surrounding_text);
-    seat->pending_surrounding_text = NULL;
+    seat->pending_surrounding_text.valid = false;
     seat->pending_text_change_cause = 0;
     seat->pending_content_type_hint = 0;
     seat->pending_content_type_purpose = 0;
@@ -865,6 +730,8 @@ void zwp_input_method_v2_deactivate(
     void *data, struct zwp_input_method_v2 *zwp_input_method_v2)
 {
     struct anthywl_seat *seat = data;
+    anthywl_recorder_write(&seat->state->recorder, seat->record_index,
+        ANTHYWL_RECORD_DEACTIVATE, NULL, 0, NULL, 0);
     seat->pending_activate = false;
 }
 
@@ -873,10 +740,11 @@ void zwp_input_method_v2_surrounding_text(
     char const *text, uint32_t cursor, uint32_t anchor)
 {
     struct anthywl_seat *seat = data;
-    free(seat->pending_surrounding_text);
-    seat->pending_surrounding_text = strdup(text);
-    seat->pending_surrounding_text_cursor = cursor;
-    seat->pending_surrounding_text_anchor = anchor;
+    anthywl_recorder_write(&seat->state->recorder, seat->record_index,
+        ANTHYWL_RECORD_SURROUNDING_TEXT, (uint32_t[]){ cursor, anchor }, 2,
+        text, strlen(text));
+    anthywl_surrounding_text_set(
+        &seat->pending_surrounding_text, text, cursor, anchor);
 }
 
 void zwp_input_method_v2_text_change_cause(
@@ -884,6 +752,8 @@ void zwp_input_method_v2_text_change_cause(
     uint32_t cause)
 {
     struct anthywl_seat *seat = data;
+    anthywl_recorder_write(&seat->state->recorder, seat->record_index,
+        ANTHYWL_RECORD_TEXT_CHANGE_CAUSE, &cause, 1, NULL, 0);
     seat->pending_text_change_cause = cause;
 }
 
@@ -892,31 +762,74 @@ void zwp_input_method_v2_content_type(
     uint32_t hint, uint32_t purpose)
 {
     struct anthywl_seat *seat = data;
+    anthywl_recorder_write(&seat->state->recorder, seat->record_index,
+        ANTHYWL_RECORD_CONTENT_TYPE, (uint32_t[]){ hint, purpose }, 2, NULL, 0);
     seat->pending_content_type_hint = hint;
     seat->pending_content_type_purpose = purpose;
 }
 
+void anthywl_seat_apply_content_type(struct anthywl_seat *seat) {
+    enum anthywl_input_mode mode = ANTHYWL_INPUT_MODE_DEFAULT;
+    if (seat->composer.active) {
+        mode = anthywl_config_input_mode(&seat->state->config,
+            seat->content_type_hint, seat->content_type_purpose);
+    }
+    if (mode == seat->composer.input_mode)
+        return;
+    if (seat->composer.input_mode == ANTHYWL_INPUT_MODE_DEFAULT)
+        seat->default_is_composing = seat->composer.is_composing;
+    if (mode == ANTHYWL_INPUT_MODE_PASSTHROUGH
+        && seat->composer.buffer.len != 0)
+    {
+        if (seat->composer.is_selecting)
+            anthywl_composer_selecting_commit(&seat->composer);
+        else
+            anthywl_composer_composing_commit(&seat->composer);
+    }
+    seat->composer.input_mode = mode;
+    switch (mode) {
+    case ANTHYWL_INPUT_MODE_DEFAULT:
+        seat->composer.is_composing = seat->default_is_composing;
+        break;
+    case ANTHYWL_INPUT_MODE_PASSTHROUGH:
+    case ANTHYWL_INPUT_MODE_LATIN:
+        seat->composer.is_composing = false;
+        break;
+    case ANTHYWL_INPUT_MODE_HIRAGANA:
+    case ANTHYWL_INPUT_MODE_KATAKANA:
+        seat->composer.is_composing = true;
+        break;
+    }
+}
+
 void zwp_input_method_v2_done(
     void *data, struct zwp_input_method_v2 *zwp_input_method_v2)
 {
     struct anthywl_seat *seat = data;
-    bool was_active = seat->active;
-    seat->active = seat->pending_activate;
-    free(seat->surrounding_text);
-    seat->surrounding_text = seat->pending_surrounding_text;
-    seat->pending_surrounding_text = NULL;
-    seat->surrounding_text_cursor = seat->pending_surrounding_text_cursor;
-    seat->surrounding_text_anchor = seat->pending_surrounding_text_anchor;
+    anthywl_recorder_write(&seat->state->recorder, seat->record_index,
+        ANTHYWL_RECORD_DONE, NULL, 0, NULL, 0);
+    bool was_active = seat->composer.active;
+    bool content_type_changed =
+        seat->content_type_hint != seat->pending_content_type_hint
+        || seat->content_type_purpose != seat->pending_content_type_purpose;
+    seat->composer.active = seat->pending_activate;
+    struct anthywl_surrounding_text surrounding_text =
+        seat->composer.surrounding_text;
+    seat->composer.surrounding_text = seat->pending_surrounding_text;
+    seat->pending_surrounding_text = surrounding_text;
+    seat->pending_surrounding_text.valid = false;
     seat->text_change_cause = seat->pending_text_change_cause;
     seat->content_type_hint = seat->pending_content_type_hint;
     seat->content_type_purpose = seat->pending_content_type_purpose;
     seat->done_events_received++;
-    if (!was_active && seat->active) {
-        seat->is_selecting = false;
-        seat->is_composing_popup_visible = false;
-        anthywl_buffer_clear(&seat->buffer);
-        anthywl_seat_draw_popup(seat);
+    if (!was_active && seat->composer.active) {
+        seat->composer.is_selecting = false;
+        seat->composer.is_composing_popup_visible = false;
+        anthywl_buffer_clear(&seat->composer.buffer);
+        anthywl_composer_update_popup(&seat->composer);
     }
+    if (was_active != seat->composer.active || content_type_changed)
+        anthywl_seat_apply_content_type(seat);
 }
 
 void zwp_input_method_v2_unavailable(
@@ -929,13 +842,12 @@ void zwp_input_method_v2_unavailable(
 
 void anthywl_seat_cursor_update(struct anthywl_seat *seat) {
     uint32_t duration;
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t now = anthywl_timer_now();
     int scale = seat->state->wl_cursor_theme_scale;
     struct wl_cursor_theme *wl_cursor_theme = seat->state->wl_cursor_theme;
     struct wl_cursor *wl_cursor =
         wl_cursor_theme_get_cursor(wl_cursor_theme, "left_ptr");
-    int time_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    int time_ms = now / 1000000;
     int frame =
         wl_cursor_frame_and_duration(wl_cursor, time_ms, &duration);
     struct wl_cursor_image *wl_cursor_image = wl_cursor->images[frame];
@@ -948,12 +860,10 @@ void anthywl_seat_cursor_update(struct anthywl_seat *seat) {
         seat->wl_pointer, seat->wl_pointer_serial, seat->wl_surface_cursor,
         wl_cursor_image->hotspot_x / scale, wl_cursor_image->hotspot_y / scale);
     if (duration == 0) {
-        wl_list_remove(&seat->cursor_timer.link);
-        wl_list_init(&seat->cursor_timer.link);
+        anthywl_timer_cancel(&seat->state->timers, &seat->cursor_timer);
     } else {
-        clock_gettime(CLOCK_MONOTONIC, &seat->cursor_timer.time);
-        seat->cursor_timer.time.tv_nsec += 1000000 * duration;
-        timespec_correct(&seat->cursor_timer.time);
+        anthywl_timer_arm(&seat->state->timers, &seat->cursor_timer,
+            now + duration * UINT64_C(1000000));
     }
 }
 
@@ -968,7 +878,11 @@ void wl_pointer_enter(void *data, struct wl_pointer *wl_pointer,
 {
     struct anthywl_seat *seat = data;
     seat->wl_pointer_serial = serial;
-    wl_list_insert(&seat->state->timers, &seat->cursor_timer.link);
+    if (seat->wp_cursor_shape_device_v1 != NULL) {
+        wp_cursor_shape_device_v1_set_shape(seat->wp_cursor_shape_device_v1,
+            serial, WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_DEFAULT);
+        return;
+    }
     anthywl_seat_cursor_update(seat);
 }
 
@@ -976,7 +890,7 @@ void wl_pointer_leave(void *data, struct wl_pointer *wl_pointer,
     uint32_t serial, struct wl_surface *surface)
 {
     struct anthywl_seat *seat = data;
-    wl_list_remove(&seat->cursor_timer.link);
+    anthywl_timer_cancel(&seat->state->timers, &seat->cursor_timer);
 }
 
 void wl_pointer_motion(void *data, struct wl_pointer *wl_pointer,
@@ -1020,10 +934,19 @@ void wl_seat_capabilities(void *data, struct wl_seat *wl_seat,
     {
         seat->wl_pointer = wl_seat_get_pointer(wl_seat);
         wl_pointer_add_listener(seat->wl_pointer, &wl_pointer_listener, seat);
+        if (seat->state->wp_cursor_shape_manager_v1 != NULL) {
+            seat->wp_cursor_shape_device_v1 =
+                wp_cursor_shape_manager_v1_get_pointer(
+                    seat->state->wp_cursor_shape_manager_v1, seat->wl_pointer);
+        }
     }
     if (!(capabilities & WL_SEAT_CAPABILITY_POINTER)
         && seat->wl_pointer != NULL)
     {
+        if (seat->wp_cursor_shape_device_v1 != NULL) {
+            wp_cursor_shape_device_v1_destroy(seat->wp_cursor_shape_device_v1);
+            seat->wp_cursor_shape_device_v1 = NULL;
+        }
         wl_pointer_release(seat->wl_pointer);
         seat->wl_pointer = NULL;
     }
@@ -1066,8 +989,11 @@ void wl_output_done(void *data, struct wl_output *wl_output) {
             scale = output_iter->scale;
     }
     output->state->max_scale = scale;
-    if (output->state->wl_cursor_theme_scale != output->state->max_scale / 24)
+    if (output->state->wp_cursor_shape_manager_v1 == NULL
+        && output->state->wl_cursor_theme_scale != output->state->max_scale / 24)
+    {
         anthywl_reload_cursor_theme(output->state);
+    }
 }
 
 void wl_output_scale(void *data, struct wl_output *wl_output,
@@ -1091,6 +1017,7 @@ struct anthywl_global {
     struct wl_interface const *interface;
     int version;
     bool is_singleton;
+    bool is_optional;
     union {
         ptrdiff_t offset;
         void (*callback)(struct anthywl_state *state, void *data);
@@ -1132,6 +1059,14 @@ static struct anthywl_global const globals[] = {
         .is_singleton = true,
         .offset = offsetof(struct anthywl_state, wl_shm),
     },
+    {
+        .name = "wp_cursor_shape_manager_v1",
+        .interface = &wp_cursor_shape_manager_v1_interface,
+        .version = 1,
+        .is_singleton = true,
+        .is_optional = true,
+        .offset = offsetof(struct anthywl_state, wp_cursor_shape_manager_v1),
+    },
     {
         .name = "zwp_input_method_manager_v2",
         .interface = &zwp_input_method_manager_v2_interface,
@@ -1193,19 +1128,57 @@ void anthywl_reload_cursor_theme(struct anthywl_state *state) {
     state->wl_cursor_theme_scale = state->max_scale;
 }
 
-bool anthywl_state_init(struct anthywl_state *state) {
+// Sets up everything but the Wayland connection and the config watch, which
+// is all replaying a recording needs.
+bool anthywl_state_init_headless(struct anthywl_state *state) {
     wl_list_init(&state->buffers);
     wl_list_init(&state->seats);
     wl_list_init(&state->outputs);
-    wl_list_init(&state->timers);
+    wl_list_init(&state->keymaps);
+    state->xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
     anthywl_config_init(&state->config);
+    state->config_source.fd = -1;
     state->max_scale = 1;
 
     if (!anthywl_config_load(&state->config))
         return false;
 
+    if (!anthywl_event_loop_init(&state->event_loop))
+        return false;
+
+    if (!anthywl_timer_queue_init(&state->timers))
+        return false;
+    state->timer_source.fd = state->timers.fd;
+    state->timer_source.callback = anthywl_state_handle_timers;
+    if (!anthywl_event_loop_add(
+        &state->event_loop, &state->timer_source, EPOLLIN))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool anthywl_state_init(struct anthywl_state *state) {
+    if (!anthywl_state_init_headless(state))
+        return false;
+
+    state->config_source.fd = anthywl_config_watch(&state->config);
+    if (state->config_source.fd != -1) {
+        state->config_source.callback = anthywl_state_handle_config_changed;
+        state->config_reload_timer.callback =
+            anthywl_state_reload_config_timer_callback;
+        if (!anthywl_event_loop_add(
+            &state->event_loop, &state->config_source, EPOLLIN))
+        {
+            return false;
+        }
+    } else {
+        fprintf(stderr, "Not watching config file for changes\n");
+    }
+
 #ifdef ANTHYWL_IPC_SUPPORT
-    if (!anthywl_ipc_init(&state->ipc))
+    if (!anthywl_ipc_init(&state->ipc, &state->event_loop))
         return false;
 #endif
 
@@ -1221,7 +1194,7 @@ bool anthywl_state_init(struct anthywl_state *state) {
 
     for (size_t i = 0; i < sizeof globals / sizeof globals[0]; i++) {
         const struct anthywl_global *global = &globals[i];
-        if (!global->is_singleton)
+        if (!global->is_singleton || global->is_optional)
             continue;
         struct wl_proxy **location =
             (struct wl_proxy **)((uintptr_t)state + global->offset);
@@ -1233,7 +1206,8 @@ bool anthywl_state_init(struct anthywl_state *state) {
         }
     }
 
-    anthywl_reload_cursor_theme(state);
+    if (state->wp_cursor_shape_manager_v1 == NULL)
+        anthywl_reload_cursor_theme(state);
 
     struct anthywl_seat *seat;
     wl_list_for_each(seat, &state->seats, link)
@@ -1241,92 +1215,140 @@ bool anthywl_state_init(struct anthywl_state *state) {
 
     wl_display_flush(state->wl_display);
 
+    state->display_source.fd = wl_display_get_fd(state->wl_display);
+    state->display_source.callback = anthywl_state_handle_display;
+    if (!anthywl_event_loop_add(
+        &state->event_loop, &state->display_source, EPOLLIN))
+    {
+        return false;
+    }
+
     return true;
 }
 
-static bool interrupted;
-static void sigint(int signal) { interrupted = true; }
-
-int anthywl_state_next_timer(struct anthywl_state *state) {
-    int timeout = INT_MAX;
-    if (wl_list_empty(&state->timers))
-        return -1;
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    struct anthywl_timer *timer;
-    wl_list_for_each(timer, &state->timers, link) {
-        int time =
-            (timer->time.tv_sec - now.tv_sec) * 1000 +
-            (timer->time.tv_nsec - now.tv_nsec) / 1000000;
-        if (time < timeout)
-            timeout = time;
-    }
-    return timeout;
+void anthywl_state_begin_batch(struct anthywl_state *state) {
+    state->batch_depth++;
+    struct anthywl_seat *seat;
+    wl_list_for_each(seat, &state->seats, link)
+        anthywl_composer_begin_batch(&seat->composer);
 }
 
-void anthywl_state_run_timers(struct anthywl_state *state) {
-    if (wl_list_empty(&state->timers))
-        return;
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    struct anthywl_timer *timer, *tmp;
-    wl_list_for_each_safe(timer, tmp, &state->timers, link) {
-        bool expired = timer->time.tv_sec < now.tv_sec ||
-            (timer->time.tv_sec == now.tv_sec &&
-             timer->time.tv_nsec < now.tv_nsec);
-         if (expired)
-             timer->callback(timer);
+void anthywl_state_end_batch(struct anthywl_state *state) {
+    state->batch_depth--;
+    struct anthywl_seat *seat;
+    wl_list_for_each(seat, &state->seats, link)
+        anthywl_composer_end_batch(&seat->composer);
+}
+
+void anthywl_state_handle_display(struct anthywl_event_source *source,
+    uint32_t events)
+{
+    struct anthywl_state *state =
+        wl_container_of(source, state, display_source);
+
+    // Every event read in one go is handled before any seat sends its
+    // preedit, commits and redraws its popup, so a burst of key events
+    // results in a single update per seat.
+    anthywl_state_begin_batch(state);
+
+    while (wl_display_prepare_read(state->wl_display) != 0)
+        wl_display_dispatch_pending(state->wl_display);
+
+    wl_display_read_events(state->wl_display);
+
+    int res = wl_display_dispatch_pending(state->wl_display);
+
+    anthywl_state_end_batch(state);
+
+    if (res == -1) {
+        perror("wl_display_dispatch");
+        state->running = false;
     }
 }
 
-void anthywl_state_run(struct anthywl_state *state) {
-    state->running = true;
-    signal(SIGINT, sigint);
-    while (state->running && !interrupted) {
-        struct pollfd pfds[] = {
-            {
-                .fd = wl_display_get_fd(state->wl_display),
-                .events = POLLIN,
-            },
-#ifdef ANTHYWL_IPC_SUPPORT
-            {
-                .fd = varlink_service_get_fd(state->ipc.service),
-                .events = POLLIN,
-            },
-#endif
-        };
+void anthywl_state_handle_timers(struct anthywl_event_source *source,
+    uint32_t events)
+{
+    struct anthywl_state *state = wl_container_of(source, state, timer_source);
+    anthywl_timer_queue_dispatch(&state->timers);
+}
 
-        if (poll(pfds, ARRAY_LEN(pfds), anthywl_state_next_timer(state)) == -1) {
-            if (errno == EINTR)
-                continue;
-            perror("poll");
-            break;
-        }
+void anthywl_state_handle_signal(struct anthywl_signal_source *source,
+    int signal)
+{
+    struct anthywl_state *state = wl_container_of(source, state, signal_source);
+    switch (signal) {
+    case SIGINT:
+    case SIGTERM:
+        state->running = false;
+        break;
+    case SIGUSR1:
+        anthywl_metrics_dump(stderr);
+        break;
+    }
+}
 
-        if (pfds[0].events & POLLIN) {
-            while (wl_display_prepare_read(state->wl_display) != 0)
-                wl_display_dispatch_pending(state->wl_display);
+// Editors tend to touch the file several times per save.
+#define CONFIG_RELOAD_DELAY_NS (50 * UINT64_C(1000000))
 
-            wl_display_read_events(state->wl_display);
+void anthywl_state_handle_config_changed(struct anthywl_event_source *source,
+    uint32_t events)
+{
+    struct anthywl_state *state =
+        wl_container_of(source, state, config_source);
+    if (anthywl_config_read_watch_events(&state->config, source->fd)) {
+        anthywl_timer_arm(&state->timers, &state->config_reload_timer,
+            anthywl_timer_now() + CONFIG_RELOAD_DELAY_NS);
+    }
+}
 
-            if (wl_display_dispatch_pending(state->wl_display) == -1) {
-                perror("wl_display_dispatch");
-                break;
-            }
+void anthywl_state_reload_config_timer_callback(struct anthywl_timer *timer) {
+    struct anthywl_state *state =
+        wl_container_of(timer, state, config_reload_timer);
+    enum anthywl_config_change changes;
+    if (!anthywl_config_reload(&state->config, &changes)) {
+        fprintf(stderr, "Failed to reload config, keeping the old one\n");
+        return;
+    }
+    if (changes == 0)
+        return;
+    struct anthywl_keymap *keymap;
+    wl_list_for_each(keymap, &state->keymaps, link)
+        anthywl_keymap_rebuild_bindings(keymap, changes);
+    if (changes & ANTHYWL_CONFIG_CONTENT_TYPE_RULES) {
+        // Otherwise edited rules would only apply on the next activation.
+        anthywl_state_begin_batch(state);
+        struct anthywl_seat *seat;
+        wl_list_for_each(seat, &state->seats, link) {
+            if (seat->composer.active)
+                anthywl_seat_apply_content_type(seat);
         }
+        anthywl_state_end_batch(state);
+    }
+}
 
-#ifdef ANTHYWL_IPC_SUPPORT
-        if (pfds[1].events & POLLIN) {
-            long res = varlink_service_process_events(state->ipc.service);
-            if (res < 0) {
-                fprintf(stderr, "varlink_service_process_events: %s\n",
-                    varlink_error_string(-res));
-                break;
-            }
-        }
-#endif
+void anthywl_state_run(struct anthywl_state *state) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    state->signal_source.callback = anthywl_state_handle_signal;
+    if (!anthywl_event_loop_add_signals(
+        &state->event_loop, &state->signal_source, &mask))
+    {
+        return;
+    }
 
-        anthywl_state_run_timers(state);
+    state->running = true;
+    while (state->running) {
+        anthywl_state_begin_batch(state);
+        int res = wl_display_dispatch_pending(state->wl_display);
+        anthywl_state_end_batch(state);
+        if (res == -1) {
+            perror("wl_display_dispatch");
+            break;
+        }
 
         wl_display_flush(state->wl_display);
 
@@ -1334,9 +1356,13 @@ void anthywl_state_run(struct anthywl_state *state) {
             fprintf(stderr, "No seats with input-method available.\n");
             break;
         }
+
+        if (anthywl_event_loop_dispatch(&state->event_loop, -1) == -1)
+            break;
     }
-    signal(SIGINT, SIG_DFL);
     state->running = false;
+
+    anthywl_event_loop_remove_signals(&state->event_loop, &state->signal_source);
 }
 
 void anthywl_state_finish(struct anthywl_state *state) {
@@ -1349,8 +1375,20 @@ void anthywl_state_finish(struct anthywl_state *state) {
     {
         anthywl_graphics_buffer_destroy(graphics_buffer);
     }
+    struct anthywl_keymap *keymap, *tmp_keymap;
+    wl_list_for_each_safe(keymap, tmp_keymap, &state->keymaps, link)
+        anthywl_keymap_destroy(keymap);
+    xkb_context_unref(state->xkb_context);
+    anthywl_timer_cancel(&state->timers, &state->config_reload_timer);
+    anthywl_timer_queue_finish(&state->timers);
+    if (state->config_source.fd != -1) {
+        anthywl_event_loop_remove(&state->event_loop, &state->config_source);
+        close(state->config_source.fd);
+    }
     if (state->wl_cursor_theme != NULL)
         wl_cursor_theme_destroy(state->wl_cursor_theme);
+    if (state->wp_cursor_shape_manager_v1 != NULL)
+        wp_cursor_shape_manager_v1_destroy(state->wp_cursor_shape_manager_v1);
     if (state->zwp_virtual_keyboard_manager_v1 != NULL) {
         zwp_virtual_keyboard_manager_v1_destroy(
             state->zwp_virtual_keyboard_manager_v1);
@@ -1368,20 +1406,73 @@ void anthywl_state_finish(struct anthywl_state *state) {
 #ifdef ANTHYWL_IPC_SUPPORT
     anthywl_ipc_finish(&state->ipc);
 #endif
+    anthywl_event_loop_finish(&state->event_loop);
     anthywl_config_finish(&state->config);
 }
 
-int main(void) {
+int main(int argc, char *argv[]) {
+    char const *trace_path = NULL;
+    char const *record_path = NULL;
+    char const *replay_path = NULL;
+    bool replay_realtime = false;
+    bool usage = false;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--trace=", strlen("--trace=")) == 0)
+            trace_path = argv[i] + strlen("--trace=");
+        else if (strncmp(argv[i], "--record=", strlen("--record=")) == 0)
+            record_path = argv[i] + strlen("--record=");
+        else if (strncmp(argv[i], "--replay=", strlen("--replay=")) == 0)
+            replay_path = argv[i] + strlen("--replay=");
+        else if (strcmp(argv[i], "--replay-realtime") == 0)
+            replay_realtime = true;
+        else
+            usage = true;
+    }
+    if (usage || (record_path != NULL && replay_path != NULL)
+        || (replay_realtime && replay_path == NULL))
+    {
+        fprintf(stderr, "Usage: %s [--trace=FILE] "
+            "[--record=FILE | --replay=FILE [--replay-realtime]]\n", argv[0]);
+        return 1;
+    }
+    if (trace_path != NULL) {
+#ifdef ANTHYWL_TRACE_SUPPORT
+        if (!anthywl_trace_start(trace_path))
+            return 1;
+#else
+        fprintf(stderr, "anthywl was built without tracing support\n");
+        return 1;
+#endif
+    }
+
+    int status = 1;
+    struct anthywl_state state = {0};
     if (anthy_init() != 0) {
         perror("anthy_init");
-        return 1;
+        goto out;
     }
     atexit(anthy_quit);
-    struct anthywl_state state = {0};
-    if (!anthywl_state_init(&state))
-        return 1;
-    anthywl_state_run(&state);
-    anthywl_state_finish(&state);
+    if (replay_path != NULL) {
+        if (anthywl_state_init_headless(&state)) {
+            if (anthywl_replay(&state, replay_path, replay_realtime))
+                status = 0;
+            anthywl_state_finish(&state);
+        }
+    } else if (record_path == NULL
+        || anthywl_recorder_open(&state.recorder, record_path))
+    {
+        if (anthywl_state_init(&state)) {
+            anthywl_state_run(&state);
+            anthywl_state_finish(&state);
+            status = 0;
+        }
+        anthywl_recorder_close(&state.recorder);
+    }
+out:
+#ifdef ANTHYWL_TRACE_SUPPORT
+    anthywl_trace_stop();
+#endif
+    return status;
 }
 
 struct zwp_input_popup_surface_v2_listener const
@@ -0,0 +1,76 @@
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ALIGN (_Alignof(max_align_t))
+#define MIN_CAP 4096
+
+struct anthywl_arena_block {
+    struct anthywl_arena_block *next;
+    max_align_t data[];
+};
+
+uint64_t anthywl_scratch_allocations;
+
+void anthywl_arena_init(struct anthywl_arena *arena) {
+    arena->data = NULL;
+    arena->len = 0;
+    arena->cap = 0;
+    arena->overflow = NULL;
+    arena->overflow_size = 0;
+}
+
+static void anthywl_arena_free_overflow(struct anthywl_arena *arena) {
+    struct anthywl_arena_block *block = arena->overflow, *next;
+    for (; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+    arena->overflow = NULL;
+    arena->overflow_size = 0;
+}
+
+void anthywl_arena_finish(struct anthywl_arena *arena) {
+    anthywl_arena_free_overflow(arena);
+    free(arena->data);
+}
+
+void anthywl_arena_reset(struct anthywl_arena *arena) {
+    // Grow to hold everything the last batch needed, so the next one like
+    // it fits without overflowing.
+    if (arena->overflow != NULL) {
+        size_t cap = arena->cap != 0 ? arena->cap : MIN_CAP;
+        while (cap < arena->len + arena->overflow_size)
+            cap *= 2;
+        anthywl_arena_free_overflow(arena);
+        free(arena->data);
+        arena->data = malloc(cap);
+        if (arena->data == NULL) {
+            perror("malloc");
+            abort();
+        }
+        arena->cap = cap;
+        anthywl_scratch_allocations++;
+    }
+    arena->len = 0;
+}
+
+void *anthywl_arena_alloc(struct anthywl_arena *arena, size_t size) {
+    size = (size + ALIGN - 1) / ALIGN * ALIGN;
+    if (arena->cap - arena->len >= size) {
+        void *ptr = arena->data + arena->len;
+        arena->len += size;
+        return ptr;
+    }
+    struct anthywl_arena_block *block = malloc(sizeof *block + size);
+    if (block == NULL) {
+        perror("malloc");
+        abort();
+    }
+    block->next = arena->overflow;
+    arena->overflow = block;
+    arena->overflow_size += size;
+    anthywl_scratch_allocations++;
+    return block->data;
+}
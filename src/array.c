@@ -0,0 +1,31 @@
+#include "array.h"
+
+#include <stdlib.h>
+
+#define MIN_ALLOC 16
+
+void anthywl_array_init(struct anthywl_array *array) {
+    array->data = NULL;
+    array->size = 0;
+    array->alloc = 0;
+}
+
+void anthywl_array_release(struct anthywl_array *array) {
+    free(array->data);
+}
+
+void *anthywl_array_add(struct anthywl_array *array, size_t size) {
+    if (array->size + size > array->alloc) {
+        size_t alloc = array->alloc != 0 ? array->alloc : MIN_ALLOC;
+        while (alloc < array->size + size)
+            alloc *= 2;
+        void *data = realloc(array->data, alloc);
+        if (data == NULL)
+            return NULL;
+        array->data = data;
+        array->alloc = alloc;
+    }
+    void *p = (char *)array->data + array->size;
+    array->size += size;
+    return p;
+}
@@ -0,0 +1,141 @@
+#include "bindings.h"
+
+#include <stdlib.h>
+
+int anthywl_binding_compare(void const *_a, void const *_b) {
+    const struct anthywl_binding *a = _a;
+    const struct anthywl_binding *b = _b;
+    int keysym = a->keysym - b->keysym;
+    if (keysym != 0)
+        return keysym;
+    int modifiers = a->modifiers - b->modifiers;
+    if (modifiers != 0)
+        return modifiers;
+    return a->action - b->action;
+}
+
+int anthywl_seat_binding_compare(void const *_a, void const *_b) {
+    const struct anthywl_seat_binding *a = _a;
+    const struct anthywl_seat_binding *b = _b;
+    int keycode = a->keycode - b->keycode;
+    if (keycode != 0)
+        return keycode;
+    int mod_mask = a->mod_mask - b->mod_mask;
+    if (mod_mask != 0)
+        return mod_mask;
+    return a->action - b->action;
+}
+
+int anthywl_keysym_keycode_compare(void const *_a, void const *_b) {
+    const struct anthywl_keysym_keycode *a = _a;
+    const struct anthywl_keysym_keycode *b = _b;
+    if (a->keysym != b->keysym)
+        return a->keysym < b->keysym ? -1 : 1;
+    return (int)a->keycode - (int)b->keycode;
+}
+
+struct add_keysym_keycode_data {
+    struct anthywl_array *keysym_keycodes;
+    struct xkb_state *xkb_state;
+};
+
+static void add_keysym_keycode(struct xkb_keymap *xkb_keymap,
+    xkb_keycode_t keycode, void *_data)
+{
+    struct add_keysym_keycode_data *data = _data;
+    xkb_keysym_t keysym = xkb_state_key_get_one_sym(data->xkb_state, keycode);
+    if (keysym == XKB_KEY_NoSymbol)
+        return;
+    struct anthywl_keysym_keycode *entry = anthywl_array_add(
+        data->keysym_keycodes, sizeof(struct anthywl_keysym_keycode));
+    entry->keysym = keysym;
+    entry->keycode = keycode;
+}
+
+void anthywl_keysym_keycodes_index(struct anthywl_array *keysym_keycodes,
+    struct xkb_keymap *xkb_keymap)
+{
+    struct add_keysym_keycode_data data = {
+        .keysym_keycodes = keysym_keycodes,
+        .xkb_state = xkb_state_new(xkb_keymap),
+    };
+    keysym_keycodes->size = 0;
+    xkb_keymap_key_for_each(xkb_keymap, add_keysym_keycode, &data);
+    xkb_state_unref(data.xkb_state);
+    qsort(keysym_keycodes->data,
+        keysym_keycodes->size / sizeof(struct anthywl_keysym_keycode),
+        sizeof(struct anthywl_keysym_keycode), anthywl_keysym_keycode_compare);
+}
+
+void anthywl_seat_bindings_set_up(struct anthywl_seat_bindings *seat_bindings,
+    struct anthywl_array const *bindings, struct anthywl_array const *keysym_keycodes,
+    xkb_mod_index_t const *mod_indices, xkb_keycode_t max_keycode)
+{
+    struct anthywl_keysym_keycode *index = keysym_keycodes->data;
+    size_t index_len =
+        keysym_keycodes->size / sizeof(struct anthywl_keysym_keycode);
+    struct anthywl_binding *binding;
+    seat_bindings->bindings.size = 0;
+    anthywl_array_for_each(binding, bindings) {
+        // Find the first keycode producing this keysym.
+        size_t lo = 0, hi = index_len;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (index[mid].keysym < binding->keysym)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        xkb_mod_mask_t mod_mask = 0;
+        for (int i = 0; i < _ANTHYWL_MOD_LAST; i++) {
+            if (binding->modifiers & (1 << i)) {
+                mod_mask |= 1 << mod_indices[i];
+            }
+        }
+        for (size_t j = lo;
+            j < index_len && index[j].keysym == binding->keysym; j++)
+        {
+            struct anthywl_seat_binding *seat_binding = anthywl_array_add(
+                &seat_bindings->bindings, sizeof(struct anthywl_seat_binding));
+            seat_binding->keycode = index[j].keycode;
+            seat_binding->mod_mask = mod_mask;
+            seat_binding->action = binding->action;
+        }
+    }
+    size_t len = seat_bindings->bindings.size
+        / sizeof(struct anthywl_seat_binding);
+    struct anthywl_seat_binding *data = seat_bindings->bindings.data;
+    qsort(data, len,
+        sizeof(struct anthywl_seat_binding), anthywl_seat_binding_compare);
+
+    seat_bindings->max_keycode = max_keycode;
+    seat_bindings->starts = realloc(seat_bindings->starts,
+        (max_keycode + 2) * sizeof *seat_bindings->starts);
+    size_t i = 0;
+    for (xkb_keycode_t keycode = 0; keycode <= max_keycode + 1; keycode++) {
+        while (i < len && data[i].keycode < keycode)
+            i++;
+        seat_bindings->starts[keycode] = i;
+    }
+}
+
+enum anthywl_action anthywl_seat_bindings_find(
+    struct anthywl_seat_bindings const *bindings,
+    xkb_keycode_t keycode, xkb_mod_mask_t mod_mask)
+{
+    if (keycode > bindings->max_keycode || bindings->starts == NULL)
+        return ANTHYWL_ACTION_INVALID;
+    struct anthywl_seat_binding const *data = bindings->bindings.data;
+    for (uint32_t i = bindings->starts[keycode];
+        i < bindings->starts[keycode + 1]; i++)
+    {
+        if (data[i].mod_mask == mod_mask)
+            return data[i].action;
+    }
+    return ANTHYWL_ACTION_INVALID;
+}
+
+void anthywl_seat_bindings_finish(struct anthywl_seat_bindings *bindings) {
+    anthywl_array_release(&bindings->bindings);
+    free(bindings->starts);
+}
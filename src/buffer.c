@@ -1,4 +1,5 @@
 #include "buffer.h"
+#include "arena.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -250,11 +251,23 @@ static char const *const *const twos[128] = {
 };
 
 void anthywl_buffer_init(struct anthywl_buffer *buffer) {
-    buffer->text = calloc(1, 1);
+    buffer->cap = 64;
+    buffer->text = calloc(1, buffer->cap);
     buffer->len = 0;
     buffer->pos = 0;
 }
 
+// The text is never shrunk, so once it has grown to the length of what is
+// usually typed, editing it doesn't allocate.
+static void anthywl_buffer_reserve(struct anthywl_buffer *buffer, size_t len) {
+    if (len + 1 <= buffer->cap)
+        return;
+    while (buffer->cap < len + 1)
+        buffer->cap *= 2;
+    buffer->text = realloc(buffer->text, buffer->cap);
+    anthywl_scratch_allocations++;
+}
+
 void anthywl_buffer_destroy(struct anthywl_buffer *buffer) {
     free(buffer->text);
 }
@@ -267,7 +280,7 @@ void anthywl_buffer_clear(struct anthywl_buffer *buffer) {
 
 void anthywl_buffer_append(struct anthywl_buffer *buffer, char const *text) {
     size_t text_len = strlen(text);
-    buffer->text = realloc(buffer->text, buffer->len + text_len + 1);
+    anthywl_buffer_reserve(buffer, buffer->len + text_len);
     if (buffer->pos == 0) {
         memmove(
             buffer->text + text_len,
@@ -476,3 +489,20 @@ void anthywl_buffer_convert_trailing_n(struct anthywl_buffer *buffer) {
         anthywl_buffer_append(buffer, "ん");
     }
 }
+
+void anthywl_buffer_convert_katakana(struct anthywl_buffer *buffer) {
+    // Hiragana and katakana are both in U+30xx, so every character keeps its
+    // three byte encoding and the buffer can be rewritten in place.
+    unsigned char *s = (unsigned char *)buffer->text;
+    for (size_t i = 0; i + 2 < buffer->len; i++) {
+        if (s[i] != 0xe3)
+            continue;
+        unsigned c = (s[i + 1] & 0x3f) << 6 | (s[i + 2] & 0x3f);
+        if (c >= 0x41 && c <= 0x96) {
+            c += 0x60;
+            s[i + 1] = 0x80 | c >> 6;
+            s[i + 2] = 0x80 | (c & 0x3f);
+        }
+        i += 2;
+    }
+}
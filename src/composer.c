@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "composer.h"
+#include "metrics.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+void anthywl_composer_init(struct anthywl_composer *composer,
+    struct anthywl_sink const *sink)
+{
+    composer->sink = sink;
+    anthywl_buffer_init(&composer->buffer);
+    anthywl_arena_init(&composer->arena);
+    composer->anthy_context = anthy_create_context();
+    anthy_context_set_encoding(composer->anthy_context, ANTHY_UTF8_ENCODING);
+}
+
+void anthywl_composer_finish(struct anthywl_composer *composer) {
+    anthy_release_context(composer->anthy_context);
+    free(composer->selected_candidates);
+    anthywl_buffer_destroy(&composer->buffer);
+    anthywl_arena_finish(&composer->arena);
+    free(composer->surrounding_text.text);
+}
+
+bool anthywl_composer_is_batching(struct anthywl_composer *composer) {
+    return composer->batch_depth != 0;
+}
+
+void anthywl_composer_begin_batch(struct anthywl_composer *composer) {
+    composer->batch_depth++;
+}
+
+void anthywl_composer_end_batch(struct anthywl_composer *composer) {
+    composer->batch_depth--;
+    if (!anthywl_composer_is_batching(composer))
+        anthywl_composer_flush_updates(composer);
+}
+
+void anthywl_composer_flush_updates(struct anthywl_composer *composer) {
+    enum anthywl_composer_update updates = composer->pending_updates;
+    composer->pending_updates = 0;
+    if (updates & ANTHYWL_COMPOSER_UPDATE_COMPOSING)
+        anthywl_composer_composing_update(composer);
+    else if (updates & ANTHYWL_COMPOSER_UPDATE_SELECTING)
+        anthywl_composer_selecting_update(composer);
+    else if (updates & ANTHYWL_COMPOSER_UPDATE_POPUP)
+        anthywl_composer_update_popup(composer);
+    anthywl_arena_reset(&composer->arena);
+}
+
+void anthywl_composer_update_popup(struct anthywl_composer *composer) {
+    if (anthywl_composer_is_batching(composer)) {
+        composer->pending_updates |= ANTHYWL_COMPOSER_UPDATE_POPUP;
+        return;
+    }
+    composer->sink->update_popup(composer);
+}
+
+// Wayland messages are limited to a few kilobytes, and laying out more text
+// than fits in a popup is wasted work.
+#define PREEDIT_WINDOW 1024
+
+static bool is_utf8_continuation(char c) {
+    return (c & 0xc0) == 0x80;
+}
+
+// Picks at most max bytes of text, centered on the given range where
+// possible, without splitting UTF-8 sequences.
+static void anthywl_text_window(char const *text, size_t len,
+    size_t begin, size_t end, size_t max,
+    size_t *window_start, size_t *window_end)
+{
+    if (len <= max) {
+        *window_start = 0;
+        *window_end = len;
+        return;
+    }
+    size_t middle = begin + (end - begin) / 2;
+    size_t start = middle > max / 2 ? middle - max / 2 : 0;
+    if (start > len - max)
+        start = len - max;
+    size_t stop = start + max;
+    while (start < len && is_utf8_continuation(text[start]))
+        start++;
+    while (stop > start && stop < len && is_utf8_continuation(text[stop]))
+        stop--;
+    *window_start = start;
+    *window_end = stop;
+}
+
+// Returns at most PREEDIT_WINDOW bytes of the text around the cursor, with
+// an ellipsis on each side that was cut off, and moves the cursor to match.
+char const *anthywl_composer_preedit_window(struct anthywl_composer *composer,
+    char const *text, size_t len, size_t *cursor_begin, size_t *cursor_end)
+{
+    if (len <= PREEDIT_WINDOW)
+        return text;
+
+    size_t start, end;
+    anthywl_text_window(text, len, *cursor_begin, *cursor_end,
+        PREEDIT_WINDOW, &start, &end);
+
+    static char const ellipsis[] = "…";
+    size_t ellipsis_len = sizeof ellipsis - 1;
+    char *window = anthywl_arena_alloc(
+        &composer->arena, end - start + ellipsis_len * 2 + 1);
+    size_t window_len = 0;
+    size_t offset = 0;
+    if (start > 0) {
+        memcpy(window, ellipsis, ellipsis_len);
+        window_len += ellipsis_len;
+        offset = ellipsis_len;
+    }
+    memcpy(window + window_len, text + start, end - start);
+    window_len += end - start;
+    if (end < len) {
+        memcpy(window + window_len, ellipsis, ellipsis_len);
+        window_len += ellipsis_len;
+    }
+    window[window_len] = '\0';
+
+    *cursor_begin = min(max(*cursor_begin, start), end) - start + offset;
+    *cursor_end = min(max(*cursor_end, start), end) - start + offset;
+    return window;
+}
+
+// Counts a preedit update or a commit of text, and the time since the key
+// that caused it.
+static void anthywl_composer_record_output(struct anthywl_composer *composer,
+    enum anthywl_counter counter, enum anthywl_stage stage)
+{
+    anthywl_metrics.counters[counter] += 1;
+    if (composer->key_time != 0) {
+        anthywl_metrics_record(stage, composer->key_time);
+        composer->key_time = 0;
+    }
+}
+
+static void anthywl_composer_record_preedit(
+    struct anthywl_composer *composer)
+{
+    anthywl_composer_record_output(
+        composer, ANTHYWL_COUNTER_PREEDITS, ANTHYWL_STAGE_KEY_TO_PREEDIT);
+}
+
+static void anthywl_composer_record_commit(struct anthywl_composer *composer) {
+    anthywl_composer_record_output(
+        composer, ANTHYWL_COUNTER_COMMITS, ANTHYWL_STAGE_KEY_TO_COMMIT);
+}
+
+void anthywl_composer_composing_update(struct anthywl_composer *composer) {
+    if (anthywl_composer_is_batching(composer)) {
+        composer->pending_updates &= ~ANTHYWL_COMPOSER_UPDATE_SELECTING;
+        composer->pending_updates |=
+            ANTHYWL_COMPOSER_UPDATE_COMPOSING | ANTHYWL_COMPOSER_UPDATE_POPUP;
+        return;
+    }
+    size_t cursor_begin = composer->buffer.pos;
+    size_t cursor_end = composer->buffer.pos;
+    char const *text = anthywl_composer_preedit_window(composer,
+        composer->buffer.text, composer->buffer.len,
+        &cursor_begin, &cursor_end);
+    composer->sink->set_preedit_string(
+        composer, text, cursor_begin, cursor_end);
+    composer->sink->commit(composer);
+    anthywl_composer_record_preedit(composer);
+    anthywl_composer_update_popup(composer);
+}
+
+static bool anthywl_composer_send_string(struct anthywl_composer *composer,
+    const char *text)
+{
+    // Committing resets the preedit, so any deferred preedit update is stale.
+    composer->pending_updates &= ~(ANTHYWL_COMPOSER_UPDATE_COMPOSING
+        | ANTHYWL_COMPOSER_UPDATE_SELECTING);
+    if (!composer->active) {
+        if (!composer->sink->type_string(composer, text))
+            return false;
+    } else {
+        composer->sink->commit_string(composer, text);
+        composer->sink->commit(composer);
+    }
+    anthywl_composer_record_commit(composer);
+    return true;
+}
+
+void anthywl_composer_composing_commit(struct anthywl_composer *composer) {
+    anthywl_composer_send_string(composer, composer->buffer.text);
+    anthywl_buffer_clear(&composer->buffer);
+    anthywl_composer_update_popup(composer);
+}
+
+char *anthywl_composer_selecting_text(struct anthywl_composer *composer,
+    size_t *cursor_begin, size_t *cursor_end)
+{
+    char *text = anthywl_arena_alloc(
+        &composer->arena, composer->segment_count * 64 + 1);
+    size_t len = 0;
+    *cursor_begin = 0;
+    *cursor_end = 0;
+    for (int i = 0; i < composer->segment_count; i++) {
+        if (i == composer->current_segment)
+            *cursor_begin = len;
+        if (anthy_get_segment(composer->anthy_context,
+            i, composer->selected_candidates[i], text + len, 64) < 0)
+        {
+            text[len] = '\0';
+        }
+        len += strlen(text + len);
+        if (i == composer->current_segment)
+            *cursor_end = len;
+    }
+    text[len] = '\0';
+    return text;
+}
+
+void anthywl_composer_selecting_update(struct anthywl_composer *composer) {
+    if (anthywl_composer_is_batching(composer)) {
+        composer->pending_updates &= ~ANTHYWL_COMPOSER_UPDATE_COMPOSING;
+        composer->pending_updates |=
+            ANTHYWL_COMPOSER_UPDATE_SELECTING | ANTHYWL_COMPOSER_UPDATE_POPUP;
+        return;
+    }
+
+    size_t cursor_begin, cursor_end;
+    char const *text = anthywl_composer_selecting_text(
+        composer, &cursor_begin, &cursor_end);
+    text = anthywl_composer_preedit_window(
+        composer, text, strlen(text), &cursor_begin, &cursor_end);
+    composer->sink->set_preedit_string(
+        composer, text, cursor_begin, cursor_end);
+    composer->sink->commit(composer);
+    anthywl_composer_record_preedit(composer);
+
+    anthywl_composer_update_popup(composer);
+}
+
+void anthywl_composer_selecting_commit(struct anthywl_composer *composer) {
+    size_t cursor_begin, cursor_end;
+    anthywl_composer_send_string(composer, anthywl_composer_selecting_text(
+        composer, &cursor_begin, &cursor_end));
+    composer->is_selecting = false;
+    composer->is_selecting_popup_visible = false;
+    anthywl_buffer_clear(&composer->buffer);
+
+    anthywl_composer_update_popup(composer);
+}
+
+// Editors may send kilobytes of surrounding text on every caret move, but
+// only the part near the cursor is ever looked at.
+#define SURROUNDING_TEXT_MAX 1024
+
+void anthywl_surrounding_text_set(struct anthywl_surrounding_text *surrounding,
+    char const *text, uint32_t cursor, uint32_t anchor)
+{
+    size_t len = strlen(text);
+    size_t cursor_offset = min((size_t)cursor, len);
+    size_t anchor_offset = min((size_t)anchor, len);
+    size_t start, end;
+    anthywl_text_window(text, len, min(cursor_offset, anchor_offset),
+        max(cursor_offset, anchor_offset), SURROUNDING_TEXT_MAX, &start, &end);
+
+    // The buffer only ever grows, so steady caret movement doesn't allocate.
+    if (end - start + 1 > surrounding->cap) {
+        surrounding->cap = end - start + 1;
+        free(surrounding->text);
+        surrounding->text = malloc(surrounding->cap);
+    }
+    memcpy(surrounding->text, text + start, end - start);
+    surrounding->text[end - start] = '\0';
+    surrounding->len = end - start;
+    surrounding->cursor = min(max(cursor_offset, start), end) - start;
+    surrounding->anchor = min(max(anchor_offset, start), end) - start;
+    surrounding->valid = true;
+}
@@ -1,16 +1,26 @@
+#include <errno.h>
 #include <scfg.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 
-#include "anthywl.h"
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "actions.h"
+#include "bindings.h"
 #include "config.h"
+#include "names.h"
+
+#include "modifier_names.inc"
 
 char const anthywl_default_config[] =
 #include "default_config.inc"
 ;
 
 static void anthywl_config_load_bindings(struct anthywl_config *config,
-    struct scfg_block *block, struct wl_array *bindings)
+    struct scfg_block *block, struct anthywl_array *bindings)
 {
     for (size_t i = 0; i < block->directives_len; i++) {
         struct scfg_directive *directive = &block->directives[i];
@@ -24,28 +34,15 @@ static void anthywl_config_load_bindings(struct anthywl_config *config,
         struct anthywl_binding binding = { 0 };
         while ((p = strchr(s, '+'))) {
             *p = 0;
-            if (strcmp(s, "Shift") == 0)
-                binding.modifiers |= ANTHYWL_SHIFT;
-            else if (strcmp(s, "Lock") == 0)
-                binding.modifiers |= ANTHYWL_CAPS;
-            else if (strcmp(s, "Ctrl") == 0 || strcmp(s, "Control") == 0)
-                binding.modifiers |= ANTHYWL_CTRL;
-            else if (strcmp(s, "Mod1") == 0 || strcmp(s, "Alt") == 0)
-                binding.modifiers |= ANTHYWL_ALT;
-            else if (strcmp(s, "Mod2") == 0)
-                binding.modifiers |= ANTHYWL_NUM;
-            else if (strcmp(s, "Mod3") == 0)
-                binding.modifiers |= ANTHYWL_MOD3;
-            else if (strcmp(s, "Mod4") == 0)
-                binding.modifiers |= ANTHYWL_LOGO;
-            else if (strcmp(s, "Mod5") == 0)
-                binding.modifiers |= ANTHYWL_MOD5;
-            else {
+            enum anthywl_modifier modifier =
+                ANTHYWL_NAME_LOOKUP(anthywl_modifier_names, s);
+            if (modifier == 0) {
                 fprintf(stderr,
                     "line %d: invalid modifier %s, binding ignored\n",
                     directive->lineno, s);
                 return;
             }
+            binding.modifiers |= modifier;
             s = p + 1;
         }
         binding.keysym = xkb_keysym_from_name(s,  XKB_KEYSYM_CASE_INSENSITIVE);
@@ -55,13 +52,105 @@ static void anthywl_config_load_bindings(struct anthywl_config *config,
             continue;
         }
         binding.action = anthywl_action_from_string(directive->params[0]);
-        *(struct anthywl_binding *)wl_array_add(bindings, sizeof binding) =
+        *(struct anthywl_binding *)anthywl_array_add(bindings, sizeof binding) =
             binding;
     }
     qsort(bindings->data, bindings->size / sizeof(struct anthywl_binding),
         sizeof(struct anthywl_binding), anthywl_binding_compare);
 }
 
+struct anthywl_config_name {
+    char const *name;
+    uint32_t value;
+};
+
+// Values from text-input-unstable-v3.
+static struct anthywl_config_name const content_type_hints[] = {
+    { "hidden-text", 0x40 },
+    { "sensitive-data", 0x80 },
+    { "latin", 0x100 },
+    { "multiline", 0x200 },
+};
+
+static struct anthywl_config_name const content_type_purposes[] = {
+    { "normal", 0 },
+    { "alpha", 1 },
+    { "digits", 2 },
+    { "number", 3 },
+    { "phone", 4 },
+    { "url", 5 },
+    { "email", 6 },
+    { "name", 7 },
+    { "password", 8 },
+    { "pin", 9 },
+    { "date", 10 },
+    { "time", 11 },
+    { "datetime", 12 },
+    { "terminal", 13 },
+};
+
+static struct anthywl_config_name const input_modes[] = {
+    { "default", ANTHYWL_INPUT_MODE_DEFAULT },
+    { "passthrough", ANTHYWL_INPUT_MODE_PASSTHROUGH },
+    { "latin", ANTHYWL_INPUT_MODE_LATIN },
+    { "hiragana", ANTHYWL_INPUT_MODE_HIRAGANA },
+    { "katakana", ANTHYWL_INPUT_MODE_KATAKANA },
+};
+
+static bool anthywl_config_lookup_name(struct anthywl_config_name const *names,
+    size_t names_len, char const *name, uint32_t *value)
+{
+    for (size_t i = 0; i < names_len; i++) {
+        if (strcmp(names[i].name, name) == 0) {
+            *value = names[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void anthywl_config_load_content_types(struct anthywl_config *config,
+    struct scfg_block *block)
+{
+    for (size_t i = 0; i < block->directives_len; i++) {
+        struct scfg_directive *directive = &block->directives[i];
+        if (directive->params_len != 1) {
+            fprintf(stderr, "line %d: invalid number of parameters "
+                "for content-type directive, ignoring\n", directive->lineno);
+            continue;
+        }
+
+        struct anthywl_content_type_rule rule = { 0 };
+        uint32_t mode;
+        if (anthywl_config_lookup_name(content_type_purposes,
+            sizeof content_type_purposes / sizeof *content_type_purposes,
+            directive->name, &rule.value))
+        {
+            rule.is_hint = false;
+        } else if (anthywl_config_lookup_name(content_type_hints,
+            sizeof content_type_hints / sizeof *content_type_hints,
+            directive->name, &rule.value))
+        {
+            rule.is_hint = true;
+        } else {
+            fprintf(stderr, "line %d: invalid content type %s, ignoring\n",
+                directive->lineno, directive->name);
+            continue;
+        }
+        if (!anthywl_config_lookup_name(input_modes,
+            sizeof input_modes / sizeof *input_modes,
+            directive->params[0], &mode))
+        {
+            fprintf(stderr, "line %d: invalid input mode %s, ignoring\n",
+                directive->lineno, directive->params[0]);
+            continue;
+        }
+        rule.mode = mode;
+        *(struct anthywl_content_type_rule *)anthywl_array_add(
+            &config->content_type_rules, sizeof rule) = rule;
+    }
+}
+
 static void anthywl_config_load_root(struct anthywl_config *config,
     struct scfg_block *root)
 {
@@ -74,6 +163,19 @@ static void anthywl_config_load_root(struct anthywl_config *config,
                     directive->lineno);
             else
                 config->active_at_startup = true;
+        } else if (strcmp(directive->name, "monitor-interval") == 0) {
+            char *end;
+            unsigned long interval = directive->params_len == 1
+                ? strtoul(directive->params[0], &end, 10) : 0;
+            if (directive->params_len != 1 || *end != '\0'
+                || interval > UINT_MAX)
+            {
+                fprintf(stderr,
+                    "line %d: monitor-interval takes a number of "
+                    "milliseconds\n", directive->lineno);
+            } else {
+                config->monitor_interval_ms = interval;
+            }
         } else if (strcmp(directive->name, "global-bindings") == 0) {
             anthywl_config_load_bindings(
                 config, &directive->children, &config->global_bindings);
@@ -83,6 +185,8 @@ static void anthywl_config_load_root(struct anthywl_config *config,
         } else if (strcmp(directive->name, "selecting-bindings") == 0) {
             anthywl_config_load_bindings(
                 config, &directive->children, &config->selecting_bindings);
+        } else if (strcmp(directive->name, "content-type") == 0) {
+            anthywl_config_load_content_types(config, &directive->children);
         } else {
             fprintf(stderr, "line %d: unknown section '%s'\n",
                 directive->lineno, directive->name);
@@ -91,29 +195,28 @@ static void anthywl_config_load_root(struct anthywl_config *config,
 }
 
 void anthywl_config_init(struct anthywl_config *config) {
-    wl_array_init(&config->global_bindings);
-    wl_array_init(&config->composing_bindings);
-    wl_array_init(&config->selecting_bindings);
+    config->watch_wd = -1;
+    config->monitor_interval_ms = 50;
+    anthywl_array_init(&config->global_bindings);
+    anthywl_array_init(&config->composing_bindings);
+    anthywl_array_init(&config->selecting_bindings);
+    anthywl_array_init(&config->content_type_rules);
 }
 
 void anthywl_config_finish(struct anthywl_config *config) {
-    wl_array_release(&config->selecting_bindings);
-    wl_array_release(&config->composing_bindings);
-    wl_array_release(&config->global_bindings);
+    anthywl_array_release(&config->content_type_rules);
+    anthywl_array_release(&config->selecting_bindings);
+    anthywl_array_release(&config->composing_bindings);
+    anthywl_array_release(&config->global_bindings);
+    free(config->watch_dir);
+    free(config->path);
 }
 
-bool anthywl_config_load(struct anthywl_config *config) {
-    char path[PATH_MAX];
-    char const *prefix;
-    if ((prefix = getenv("XDG_CONFIG_HOME"))) {
-        snprintf(path, sizeof path, "%s/anthywl/config", prefix);
-    } else if ((prefix = getenv("HOME"))) {
-        snprintf(path, sizeof path, "%s/.config/anthywl/config", prefix);
-    } else {
-        fprintf(stderr, "cannot find config file\n");
-        return false;
-    }
-
+// Returns false only if the file couldn't be opened; a file that fails to
+// parse leaves the config untouched and sets *parsed to false.
+static bool anthywl_config_load_file(struct anthywl_config *config,
+    char const *path, bool *parsed)
+{
     FILE *f = fopen(path, "r");
     if (f == NULL)
         f = fmemopen((char *)anthywl_default_config,
@@ -125,7 +228,8 @@ bool anthywl_config_load(struct anthywl_config *config) {
     }
 
     struct scfg_block root;
-    if (scfg_parse_file(&root, f))
+    *parsed = scfg_parse_file(&root, f) == 0;
+    if (!*parsed)
         goto close;
     anthywl_config_load_root(config, &root);
     scfg_block_finish(&root);
@@ -134,3 +238,206 @@ close:
     return true;
 }
 
+bool anthywl_config_load(struct anthywl_config *config) {
+    char path[PATH_MAX];
+    char const *prefix;
+    if ((prefix = getenv("XDG_CONFIG_HOME"))) {
+        snprintf(path, sizeof path, "%s/anthywl/config", prefix);
+    } else if ((prefix = getenv("HOME"))) {
+        snprintf(path, sizeof path, "%s/.config/anthywl/config", prefix);
+    } else {
+        fprintf(stderr, "cannot find config file\n");
+        return false;
+    }
+
+    free(config->path);
+    config->path = strdup(path);
+
+    bool parsed;
+    return anthywl_config_load_file(config, path, &parsed);
+}
+
+static bool anthywl_config_bindings_equal(
+    struct anthywl_array const *a, struct anthywl_array const *b)
+{
+    // Both arrays are kept sorted, so equal sets compare equal bytewise.
+    return a->size == b->size && memcmp(a->data, b->data, a->size) == 0;
+}
+
+static bool anthywl_config_rules_equal(
+    struct anthywl_array const *a, struct anthywl_array const *b)
+{
+    // Compared field by field, since rules have padding.
+    if (a->size != b->size)
+        return false;
+    struct anthywl_content_type_rule const *rules_a = a->data;
+    struct anthywl_content_type_rule const *rules_b = b->data;
+    for (size_t i = 0; i < a->size / sizeof *rules_a; i++) {
+        if (rules_a[i].is_hint != rules_b[i].is_hint
+            || rules_a[i].value != rules_b[i].value
+            || rules_a[i].mode != rules_b[i].mode)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void anthywl_config_array_swap(struct anthywl_array *a, struct anthywl_array *b) {
+    struct anthywl_array tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+bool anthywl_config_reload(struct anthywl_config *config,
+    enum anthywl_config_change *changes)
+{
+    *changes = 0;
+
+    struct anthywl_config new_config = { 0 };
+    anthywl_config_init(&new_config);
+    bool parsed;
+    if (!anthywl_config_load_file(&new_config, config->path, &parsed)
+        || !parsed)
+    {
+        anthywl_config_finish(&new_config);
+        return false;
+    }
+
+    config->active_at_startup = new_config.active_at_startup;
+    config->monitor_interval_ms = new_config.monitor_interval_ms;
+    if (!anthywl_config_bindings_equal(
+        &config->global_bindings, &new_config.global_bindings))
+    {
+        anthywl_config_array_swap(
+            &config->global_bindings, &new_config.global_bindings);
+        *changes |= ANTHYWL_CONFIG_GLOBAL_BINDINGS;
+    }
+    if (!anthywl_config_bindings_equal(
+        &config->composing_bindings, &new_config.composing_bindings))
+    {
+        anthywl_config_array_swap(
+            &config->composing_bindings, &new_config.composing_bindings);
+        *changes |= ANTHYWL_CONFIG_COMPOSING_BINDINGS;
+    }
+    if (!anthywl_config_bindings_equal(
+        &config->selecting_bindings, &new_config.selecting_bindings))
+    {
+        anthywl_config_array_swap(
+            &config->selecting_bindings, &new_config.selecting_bindings);
+        *changes |= ANTHYWL_CONFIG_SELECTING_BINDINGS;
+    }
+
+    if (!anthywl_config_rules_equal(
+        &config->content_type_rules, &new_config.content_type_rules))
+    {
+        anthywl_config_array_swap(
+            &config->content_type_rules, &new_config.content_type_rules);
+        *changes |= ANTHYWL_CONFIG_CONTENT_TYPE_RULES;
+    }
+
+    anthywl_config_finish(&new_config);
+    return true;
+}
+
+enum anthywl_input_mode anthywl_config_input_mode(
+    struct anthywl_config *config, uint32_t hint, uint32_t purpose)
+{
+    struct anthywl_content_type_rule *rule;
+    anthywl_array_for_each(rule, &config->content_type_rules) {
+        if (rule->is_hint ? (hint & rule->value) != 0 : purpose == rule->value)
+            return rule->mode;
+    }
+    return ANTHYWL_INPUT_MODE_DEFAULT;
+}
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM \
+    | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// Directories are watched rather than the file itself, since editors
+// commonly save by renaming a new file over the old one. When the file's
+// directory doesn't exist yet, as for new users, its closest existing
+// ancestor is watched until it does.
+static bool anthywl_config_add_watch(struct anthywl_config *config, int fd) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof dir, "%s", config->path);
+    char *slash;
+    while ((slash = strrchr(dir, '/')) != NULL) {
+        if (slash == dir)
+            slash[1] = '\0';
+        else
+            *slash = '\0';
+        int wd = inotify_add_watch(fd, dir, WATCH_EVENTS);
+        if (wd != -1) {
+            free(config->watch_dir);
+            config->watch_dir = strdup(dir);
+            config->watch_wd = wd;
+            return true;
+        }
+        if (errno != ENOENT && errno != ENOTDIR) {
+            perror("inotify_add_watch");
+            return false;
+        }
+        if (slash == dir)
+            break;
+    }
+    return false;
+}
+
+int anthywl_config_watch(struct anthywl_config *config) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1) {
+        perror("inotify_init1");
+        return -1;
+    }
+    if (!anthywl_config_add_watch(config, fd)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool anthywl_config_read_watch_events(struct anthywl_config *config, int fd) {
+    // The entry in the watched directory that leads to the file, and
+    // whether it's the file itself.
+    char const *name = config->path + strlen(config->watch_dir);
+    if (*name == '/')
+        name++;
+    size_t name_len = strcspn(name, "/");
+    bool is_file = name[name_len] == '\0';
+
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false, rearm = false;
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof buf)) > 0) {
+        struct inotify_event const *event;
+        for (char *p = buf; p < buf + len;
+            p += sizeof(struct inotify_event) + event->len)
+        {
+            event = (struct inotify_event const *)p;
+            if (event->wd != config->watch_wd)
+                continue;
+            if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                rearm = true;
+            } else if (event->len != 0
+                && strncmp(event->name, name, name_len) == 0
+                && event->name[name_len] == '\0')
+            {
+                if (is_file)
+                    changed = true;
+                else
+                    rearm = true;
+            }
+        }
+    }
+    if (rearm) {
+        inotify_rm_watch(fd, config->watch_wd);
+        config->watch_wd = -1;
+        if (!anthywl_config_add_watch(config, fd))
+            fprintf(stderr, "Stopped watching config file for changes\n");
+        // The file may have been written before the new watch was added.
+        changed = true;
+    }
+    return changed;
+}
@@ -0,0 +1,131 @@
+#include "event_loop.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include <wayland-util.h>
+
+#define ARRAY_LEN(x) (sizeof (x) / sizeof *(x))
+
+bool anthywl_event_loop_init(struct anthywl_event_loop *loop) {
+    loop->fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->fd == -1) {
+        perror("epoll_create1");
+        return false;
+    }
+    loop->events_len = 0;
+    loop->events_pos = 0;
+    return true;
+}
+
+void anthywl_event_loop_finish(struct anthywl_event_loop *loop) {
+    if (loop->fd != -1)
+        close(loop->fd);
+    loop->fd = -1;
+}
+
+bool anthywl_event_loop_add(struct anthywl_event_loop *loop,
+    struct anthywl_event_source *source, uint32_t events)
+{
+    struct epoll_event event = {
+        .events = events,
+        .data.ptr = source,
+    };
+    if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, source->fd, &event) == -1) {
+        perror("epoll_ctl");
+        return false;
+    }
+    return true;
+}
+
+bool anthywl_event_loop_modify(struct anthywl_event_loop *loop,
+    struct anthywl_event_source *source, uint32_t events)
+{
+    struct epoll_event event = {
+        .events = events,
+        .data.ptr = source,
+    };
+    if (epoll_ctl(loop->fd, EPOLL_CTL_MOD, source->fd, &event) == -1) {
+        perror("epoll_ctl");
+        return false;
+    }
+    return true;
+}
+
+void anthywl_event_loop_remove(struct anthywl_event_loop *loop,
+    struct anthywl_event_source *source)
+{
+    epoll_ctl(loop->fd, EPOLL_CTL_DEL, source->fd, NULL);
+    // The source may already be in the batch currently being dispatched.
+    for (int i = loop->events_pos + 1; i < loop->events_len; i++) {
+        if (loop->events[i].data.ptr == source)
+            loop->events[i].data.ptr = NULL;
+    }
+}
+
+static void anthywl_signal_source_handle(struct anthywl_event_source *source,
+    uint32_t events)
+{
+    struct anthywl_signal_source *signal_source =
+        wl_container_of(source, signal_source, source);
+    struct signalfd_siginfo info;
+    while (read(source->fd, &info, sizeof info) == sizeof info)
+        signal_source->callback(signal_source, info.ssi_signo);
+}
+
+bool anthywl_event_loop_add_signals(struct anthywl_event_loop *loop,
+    struct anthywl_signal_source *source, sigset_t const *mask)
+{
+    source->mask = *mask;
+    if (sigprocmask(SIG_BLOCK, mask, &source->old_mask) == -1) {
+        perror("sigprocmask");
+        return false;
+    }
+    source->source.fd = signalfd(-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (source->source.fd == -1) {
+        perror("signalfd");
+        sigprocmask(SIG_SETMASK, &source->old_mask, NULL);
+        return false;
+    }
+    source->source.callback = anthywl_signal_source_handle;
+    if (!anthywl_event_loop_add(loop, &source->source, EPOLLIN)) {
+        close(source->source.fd);
+        sigprocmask(SIG_SETMASK, &source->old_mask, NULL);
+        return false;
+    }
+    return true;
+}
+
+void anthywl_event_loop_remove_signals(struct anthywl_event_loop *loop,
+    struct anthywl_signal_source *source)
+{
+    anthywl_event_loop_remove(loop, &source->source);
+    close(source->source.fd);
+    sigprocmask(SIG_SETMASK, &source->old_mask, NULL);
+}
+
+int anthywl_event_loop_dispatch(struct anthywl_event_loop *loop, int timeout) {
+    ANTHYWL_TRACE_BEGIN("epoll_wait");
+    int n = epoll_wait(loop->fd, loop->events, ARRAY_LEN(loop->events), timeout);
+    ANTHYWL_TRACE_END("epoll_wait");
+    if (n == -1) {
+        if (errno == EINTR)
+            return 0;
+        perror("epoll_wait");
+        return -1;
+    }
+    loop->events_len = n;
+    for (loop->events_pos = 0; loop->events_pos < n; loop->events_pos++) {
+        struct epoll_event *event = &loop->events[loop->events_pos];
+        struct anthywl_event_source *source = event->data.ptr;
+        if (source != NULL)
+            source->callback(source, event->events);
+    }
+    loop->events_len = 0;
+    loop->events_pos = 0;
+    return n;
+}
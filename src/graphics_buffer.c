@@ -1,4 +1,5 @@
 #include "graphics_buffer.h"
+#include "metrics.h"
 
 #include <stdlib.h>
 #include <sys/mman.h>
@@ -17,6 +18,7 @@ static struct anthywl_graphics_buffer *anthywl_graphics_buffer_create(
     struct wl_shm *wl_shm, struct wl_list *buffers, int width, int height)
 {
     struct anthywl_graphics_buffer *buffer = calloc(1, sizeof *buffer);
+    anthywl_metrics.counters[ANTHYWL_COUNTER_BUFFERS_CREATED] += 1;
 
     buffer->width = width;
     buffer->height = height;
@@ -30,16 +32,20 @@ static struct anthywl_graphics_buffer *anthywl_graphics_buffer_create(
     buffer->data =
         mmap(NULL, buffer->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 
-    struct wl_shm_pool *pool = wl_shm_create_pool(wl_shm, fd, buffer->size);
+    // Without a compositor, as when replaying, buffers are only drawn into.
+    if (wl_shm != NULL) {
+        struct wl_shm_pool *pool =
+            wl_shm_create_pool(wl_shm, fd, buffer->size);
 
-    buffer->wl_buffer = wl_shm_pool_create_buffer(
-        pool, 0, buffer->width, buffer->height,
-        buffer->stride, WL_SHM_FORMAT_ARGB8888);
+        buffer->wl_buffer = wl_shm_pool_create_buffer(
+            pool, 0, buffer->width, buffer->height,
+            buffer->stride, WL_SHM_FORMAT_ARGB8888);
 
-    close(fd);
-    wl_shm_pool_destroy(pool);
+        wl_shm_pool_destroy(pool);
 
-    wl_buffer_add_listener(buffer->wl_buffer, &wl_buffer_listener, buffer);
+        wl_buffer_add_listener(buffer->wl_buffer, &wl_buffer_listener, buffer);
+    }
+    close(fd);
     wl_list_insert(buffers, &buffer->link);
 
     buffer->cairo_surface = cairo_image_surface_create_for_data(
@@ -56,7 +62,8 @@ void anthywl_graphics_buffer_destroy(
     cairo_destroy(buffer->cairo);
     cairo_surface_destroy(buffer->cairo_surface);
     munmap(buffer->data, buffer->size);
-    wl_buffer_destroy(buffer->wl_buffer);
+    if (buffer->wl_buffer != NULL)
+        wl_buffer_destroy(buffer->wl_buffer);
     wl_list_remove(&buffer->link);
     free(buffer);
 }
@@ -75,8 +82,6 @@ struct anthywl_graphics_buffer *anthywl_graphics_buffer_get(
             anthywl_graphics_buffer_destroy(buffer);
             continue;
         }
-        cairo_destroy(buffer->cairo);
-        buffer->cairo = cairo_create(buffer->cairo_surface);
         found = true;
         break;
     }
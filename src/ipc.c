@@ -1,11 +1,16 @@
 #include "ipc.h"
 #include "anthywl.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <limits.h>
 
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
 int anthywl_ipc_addr(char *addr, size_t size) {
     char const *wayland_display = getenv("WAYLAND_DISPLAY");
     char const *xdg_runtime_dir = getenv("XDG_RUNTIME_DIR");
@@ -25,7 +30,772 @@ static char const ca_tadeo_anthywl_interface[] =
 #include "ca.tadeo.anthywl.varlink.inc"
 ;
 
-bool anthywl_ipc_init(struct anthywl_ipc *ipc) {
+static void anthywl_ipc_wake(int fd) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof one) < 0)
+        perror("write");
+}
+
+static void anthywl_ipc_command_destroy(struct anthywl_ipc_command *command) {
+    free(command->seat);
+    free(command->actions);
+    free(command->input);
+    free(command);
+}
+
+static void anthywl_ipc_call_release(struct anthywl_ipc_call *call) {
+    varlink_call_set_canceled_callback(call->call, NULL, NULL);
+    varlink_call_unref(call->call);
+    free(call);
+}
+
+// IPC thread
+
+static void anthywl_ipc_send_command(struct anthywl_ipc *ipc,
+    struct anthywl_ipc_command *command)
+{
+    // Each call in flight has at most a command and a cancellation queued,
+    // and the queue has room for both.
+    if (!anthywl_queue_push(&ipc->commands, command)) {
+        fprintf(stderr, "IPC command queue overflowed\n");
+        anthywl_ipc_command_destroy(command);
+        return;
+    }
+    anthywl_ipc_wake(ipc->source.fd);
+}
+
+static void anthywl_ipc_call_canceled(VarlinkCall *varlink_call,
+    void *userdata)
+{
+    struct anthywl_ipc_call *call = userdata;
+    if (call->canceled)
+        return;
+    call->canceled = true;
+    struct anthywl_ipc_command *command = calloc(1, sizeof *command);
+    command->type = ANTHYWL_IPC_COMMAND_CANCELED;
+    command->call = call;
+    anthywl_ipc_send_command(call->ipc, command);
+}
+
+static long anthywl_ipc_forward(struct anthywl_ipc *ipc, VarlinkCall *call,
+    struct anthywl_ipc_command *command)
+{
+    if (ipc->calls_len >= ANTHYWL_IPC_CALLS_MAX) {
+        anthywl_ipc_command_destroy(command);
+        return varlink_call_reply_error(call, "ca.tadeo.anthywl.Busy", NULL);
+    }
+    command->call = calloc(1, sizeof *command->call);
+    command->call->ipc = ipc;
+    command->call->call = varlink_call_ref(call);
+    varlink_call_set_canceled_callback(
+        call, anthywl_ipc_call_canceled, command->call);
+    ipc->calls_len++;
+    anthywl_ipc_send_command(ipc, command);
+    return 0;
+}
+
+static void anthywl_ipc_send_replies(struct anthywl_ipc *ipc) {
+    struct anthywl_ipc_reply *reply;
+    while ((reply = anthywl_queue_pop(&ipc->replies)) != NULL) {
+        struct anthywl_ipc_call *call = reply->call;
+        long res = 0;
+        if (call->canceled) {
+            // Nobody is listening anymore.
+        } else if (reply->error != NULL) {
+            res = varlink_call_reply_error(
+                call->call, reply->error, reply->parameters);
+        } else {
+            res = varlink_call_reply(call->call, reply->parameters,
+                reply->continues ? VARLINK_REPLY_CONTINUES : 0);
+        }
+        if (reply->parameters != NULL)
+            varlink_object_unref(reply->parameters);
+        if (!reply->continues) {
+            anthywl_ipc_call_release(call);
+            ipc->calls_len--;
+        } else if (res < 0) {
+            // libvarlink queues what the socket won't take. A client that
+            // stopped reading eventually makes replying fail, and is then
+            // treated as gone rather than buffered without limit.
+            anthywl_ipc_call_canceled(call->call, call);
+        }
+        free(reply);
+    }
+}
+
+static long anthywl_ipc_handle_action(VarlinkService *service,
+    VarlinkCall *call, VarlinkObject *parameters, uint64_t flags,
+    void *userdata)
+{
+    long res;
+    char const *seat_name, *action_name;
+    if ((res = varlink_object_get_string(parameters, "seat", &seat_name)) < 0)
+        return varlink_call_reply_invalid_parameter(call, "seat");
+    if ((res = varlink_object_get_string(parameters, "action", &action_name)) < 0)
+        return varlink_call_reply_invalid_parameter(call, "action");
+    enum anthywl_action action = anthywl_action_from_string(action_name);
+    if (action == ANTHYWL_ACTION_INVALID)
+        return varlink_call_reply_invalid_parameter(call, "action");
+
+    struct anthywl_ipc_command *command = calloc(1, sizeof *command);
+    command->type = ANTHYWL_IPC_COMMAND_ACTIONS;
+    command->seat = strdup(seat_name);
+    command->single = true;
+    command->actions = malloc(sizeof *command->actions);
+    command->actions[0] = action;
+    command->actions_len = 1;
+    return anthywl_ipc_forward(userdata, call, command);
+}
+
+static long anthywl_ipc_handle_actions(VarlinkService *service,
+    VarlinkCall *call, VarlinkObject *parameters, uint64_t flags,
+    void *userdata)
+{
+    long res;
+    char const *seat_name;
+    VarlinkArray *action_names;
+    if ((res = varlink_object_get_string(parameters, "seat", &seat_name)) < 0)
+        return varlink_call_reply_invalid_parameter(call, "seat");
+    if ((res = varlink_object_get_array(parameters, "actions", &action_names)) < 0)
+        return varlink_call_reply_invalid_parameter(call, "actions");
+
+    // Parse everything up front, so a bad name doesn't leave the seat with
+    // only part of the sequence applied.
+    unsigned long len = varlink_array_get_n_elements(action_names);
+    enum anthywl_action *actions = calloc(len, sizeof *actions);
+    for (unsigned long i = 0; i < len; i++) {
+        char const *action_name;
+        if (varlink_array_get_string(action_names, i, &action_name) < 0
+            || (actions[i] = anthywl_action_from_string(action_name))
+                == ANTHYWL_ACTION_INVALID)
+        {
+            free(actions);
+            return varlink_call_reply_invalid_parameter(call, "actions");
+        }
+    }
+
+    struct anthywl_ipc_command *command = calloc(1, sizeof *command);
+    command->type = ANTHYWL_IPC_COMMAND_ACTIONS;
+    command->seat = strdup(seat_name);
+    command->actions = actions;
+    command->actions_len = len;
+    return anthywl_ipc_forward(userdata, call, command);
+}
+
+static long anthywl_ipc_handle_monitor(VarlinkService *service,
+    VarlinkCall *call, VarlinkObject *parameters, uint64_t flags,
+    void *userdata)
+{
+    long res;
+    char const *seat_name;
+    if ((res = varlink_object_get_string(parameters, "seat", &seat_name)) < 0)
+        return varlink_call_reply_invalid_parameter(call, "seat");
+
+    struct anthywl_ipc_command *command = calloc(1, sizeof *command);
+    command->type = ANTHYWL_IPC_COMMAND_MONITOR;
+    command->seat = strdup(seat_name);
+    command->more = flags & VARLINK_CALL_MORE;
+    return anthywl_ipc_forward(userdata, call, command);
+}
+
+// Segmenting is a single anthy_set_string call that can't be split into
+// slices, and it takes much longer the more it segments at once. This keeps
+// it to about what selecting a sentence-long preedit takes, so bulk calls
+// can't stall typing for longer than typing itself does.
+#define CONVERT_INPUT_MAX 128
+
+static long anthywl_ipc_handle_convert(VarlinkService *service,
+    VarlinkCall *call, VarlinkObject *parameters, uint64_t flags,
+    void *userdata)
+{
+    long res;
+    char const *input;
+    int64_t max_candidates = 0;
+    if ((res = varlink_object_get_string(parameters, "input", &input)) < 0
+        || strlen(input) > CONVERT_INPUT_MAX)
+    {
+        return varlink_call_reply_invalid_parameter(call, "input");
+    }
+    varlink_object_get_int(parameters, "max_candidates", &max_candidates);
+
+    struct anthywl_ipc_command *command = calloc(1, sizeof *command);
+    command->type = ANTHYWL_IPC_COMMAND_CONVERT;
+    command->input = strdup(input);
+    command->max_candidates = max_candidates;
+    return anthywl_ipc_forward(userdata, call, command);
+}
+
+static long anthywl_ipc_handle_get_metrics(VarlinkService *service,
+    VarlinkCall *call, VarlinkObject *parameters, uint64_t flags,
+    void *userdata)
+{
+    struct anthywl_ipc_command *command = calloc(1, sizeof *command);
+    command->type = ANTHYWL_IPC_COMMAND_GET_METRICS;
+    return anthywl_ipc_forward(userdata, call, command);
+}
+
+static void *anthywl_ipc_thread(void *data) {
+    struct anthywl_ipc *ipc = data;
+    struct pollfd fds[] = {
+        { .fd = varlink_service_get_fd(ipc->service), .events = POLLIN },
+        { .fd = ipc->thread_fd, .events = POLLIN },
+    };
+    while (!atomic_load(&ipc->stop)) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            if (read(ipc->thread_fd, &count, sizeof count) < 0)
+                perror("read");
+            anthywl_ipc_send_replies(ipc);
+        }
+        if (fds[0].revents & POLLIN) {
+            long res = varlink_service_process_events(ipc->service);
+            if (res < 0) {
+                fprintf(stderr, "varlink_service_process_events: %s\n",
+                    varlink_error_string(-res));
+                break;
+            }
+        }
+    }
+    if (!atomic_load(&ipc->stop)) {
+        atomic_store(&ipc->failed, true);
+        anthywl_ipc_wake(ipc->source.fd);
+    }
+    return NULL;
+}
+
+// Main thread
+
+static void anthywl_ipc_send_reply(struct anthywl_ipc *ipc,
+    struct anthywl_ipc_call *call, char const *error,
+    VarlinkObject *parameters, bool continues)
+{
+    struct anthywl_ipc_reply *reply = calloc(1, sizeof *reply);
+    reply->call = call;
+    reply->error = error;
+    reply->parameters = parameters;
+    reply->continues = continues;
+    // Final replies always fit, as there is at most one per call in flight
+    // and monitors leave room for them.
+    if (!anthywl_queue_push(&ipc->replies, reply)) {
+        fprintf(stderr, "IPC reply queue overflowed\n");
+        if (parameters != NULL)
+            varlink_object_unref(parameters);
+        free(reply);
+        return;
+    }
+    anthywl_ipc_wake(ipc->thread_fd);
+}
+
+static struct anthywl_seat *anthywl_ipc_find_seat(
+    struct anthywl_state *state, char const *seat_name)
+{
+    struct anthywl_seat *seat;
+    wl_list_for_each(seat, &state->seats, link) {
+        if (strcmp(seat->name, seat_name) == 0)
+            return seat;
+    }
+    return NULL;
+}
+
+static void anthywl_ipc_reply_no_such_seat(struct anthywl_ipc *ipc,
+    struct anthywl_ipc_call *call, char const *seat_name)
+{
+    VarlinkObject *no_such_seat = NULL;
+    if (varlink_object_new(&no_such_seat) >= 0)
+        varlink_object_set_string(no_such_seat, "seat", seat_name);
+    anthywl_ipc_send_reply(
+        ipc, call, "ca.tadeo.anthywl.NoSuchSeat", no_such_seat, false);
+}
+
+static void anthywl_ipc_monitor_destroy(struct anthywl_ipc_monitor *monitor) {
+    struct anthywl_state *state = wl_container_of(monitor->ipc, state, ipc);
+    anthywl_timer_cancel(&state->timers, &monitor->timer);
+    wl_list_remove(&monitor->link);
+    free(monitor);
+}
+
+static void anthywl_ipc_hash(uint64_t *hash, void const *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        *hash ^= ((unsigned char const *)data)[i];
+        *hash *= UINT64_C(0x100000001b3);
+    }
+}
+
+static void anthywl_ipc_hash_string(uint64_t *hash, char const *string) {
+    anthywl_ipc_hash(hash, string, strlen(string) + 1);
+}
+
+// Builds a ca.tadeo.anthywl.State, and a hash of it to tell whether
+// anything changed since the last one was sent.
+static long anthywl_ipc_seat_state(struct anthywl_seat *seat,
+    VarlinkObject **out, uint64_t *hash)
+{
+    struct anthywl_composer *composer = &seat->composer;
+    long res;
+    VarlinkObject *object;
+    VarlinkArray *candidates;
+    if ((res = varlink_object_new(&object)) < 0)
+        return res;
+    if ((res = varlink_array_new(&candidates)) < 0) {
+        varlink_object_unref(object);
+        return res;
+    }
+    *hash = UINT64_C(0xcbf29ce484222325);
+
+    char const *mode = "off";
+    char const *preedit = "";
+    size_t cursor = 0;
+    int64_t candidate = -1;
+    if (composer->is_selecting) {
+        mode = "selecting";
+        size_t cursor_end;
+        preedit = anthywl_composer_selecting_text(
+            composer, &cursor, &cursor_end);
+        struct anthy_segment_stat stat;
+        if (anthy_get_segment_stat(
+            composer->anthy_context, composer->current_segment, &stat) == 0)
+        {
+            for (int i = 0; i < stat.nr_candidate; i++) {
+                char buf[64];
+                if (anthy_get_segment(composer->anthy_context,
+                    composer->current_segment, i, buf, sizeof buf) < 0)
+                {
+                    buf[0] = '\0';
+                }
+                varlink_array_append_string(candidates, buf);
+                anthywl_ipc_hash_string(hash, buf);
+            }
+            candidate =
+                composer->selected_candidates[composer->current_segment];
+        }
+    } else if (composer->is_composing) {
+        mode = "composing";
+        preedit = composer->buffer.text;
+        cursor = composer->buffer.pos;
+    }
+    anthywl_ipc_hash_string(hash, mode);
+    anthywl_ipc_hash_string(hash, preedit);
+    anthywl_ipc_hash(hash, &cursor, sizeof cursor);
+    anthywl_ipc_hash(hash, &candidate, sizeof candidate);
+
+    varlink_object_set_string(object, "mode", mode);
+    varlink_object_set_string(object, "preedit", preedit);
+    varlink_object_set_int(object, "cursor", cursor);
+    varlink_object_set_array(object, "candidates", candidates);
+    varlink_object_set_int(object, "candidate", candidate);
+    varlink_array_unref(candidates);
+    if (!anthywl_composer_is_batching(composer))
+        anthywl_arena_reset(&composer->arena);
+    *out = object;
+    return 0;
+}
+
+static VarlinkObject *anthywl_ipc_state_reply(struct anthywl_seat *seat,
+    uint64_t *hash)
+{
+    VarlinkObject *state, *reply;
+    if (anthywl_ipc_seat_state(seat, &state, hash) < 0)
+        return NULL;
+    if (varlink_object_new(&reply) < 0) {
+        varlink_object_unref(state);
+        return NULL;
+    }
+    varlink_object_set_object(reply, "state", state);
+    varlink_object_unref(state);
+    return reply;
+}
+
+static void anthywl_ipc_monitor_timer_callback(struct anthywl_timer *timer) {
+    struct anthywl_ipc_monitor *monitor =
+        wl_container_of(timer, monitor, timer);
+    struct anthywl_ipc *ipc = monitor->ipc;
+    struct anthywl_state *state = wl_container_of(ipc, state, ipc);
+    // Leave room in the reply queue for every call's final reply. A
+    // monitor that can't send now tries again after another interval.
+    if (anthywl_queue_len(&ipc->replies) >= ANTHYWL_IPC_CALLS_MAX) {
+        anthywl_timer_arm(&state->timers, &monitor->timer, anthywl_timer_now()
+            + state->config.monitor_interval_ms * UINT64_C(1000000));
+        return;
+    }
+    uint64_t hash;
+    VarlinkObject *reply = anthywl_ipc_state_reply(monitor->seat, &hash);
+    if (reply == NULL)
+        return;
+    if (hash == monitor->last_hash) {
+        varlink_object_unref(reply);
+        return;
+    }
+    anthywl_ipc_send_reply(ipc, monitor->call, NULL, reply, true);
+    monitor->last_hash = hash;
+    monitor->last_sent = anthywl_timer_now();
+}
+
+void anthywl_ipc_seat_changed(struct anthywl_ipc *ipc,
+    struct anthywl_seat *seat)
+{
+    // Not set up when replaying a recording.
+    if (ipc->service == NULL)
+        return;
+    struct anthywl_state *state = wl_container_of(ipc, state, ipc);
+    uint64_t now = anthywl_timer_now();
+    uint64_t interval =
+        state->config.monitor_interval_ms * UINT64_C(1000000);
+    struct anthywl_ipc_monitor *monitor;
+    wl_list_for_each(monitor, &ipc->monitors, link) {
+        // Nothing is sent from the input path itself; the timer fires once
+        // the current batch of events has been handled.
+        if (monitor->seat != seat || anthywl_timer_is_armed(&monitor->timer))
+            continue;
+        uint64_t deadline = monitor->last_sent + interval;
+        anthywl_timer_arm(&state->timers, &monitor->timer,
+            deadline > now ? deadline : now);
+    }
+}
+
+void anthywl_ipc_seat_destroyed(struct anthywl_ipc *ipc,
+    struct anthywl_seat *seat)
+{
+    if (ipc->service == NULL)
+        return;
+    struct anthywl_ipc_monitor *monitor, *tmp;
+    wl_list_for_each_safe(monitor, tmp, &ipc->monitors, link) {
+        if (monitor->seat == seat) {
+            anthywl_ipc_reply_no_such_seat(ipc, monitor->call, seat->name);
+            anthywl_ipc_monitor_destroy(monitor);
+        }
+    }
+}
+
+// How long a Convert call can wait behind others before it is answered with
+// Busy instead, and how long listing candidates can take in one main loop
+// iteration.
+#define CONVERT_WAIT_MAX_NS (500 * 1000000L)
+#define CONVERT_SLICE_NS (2 * 1000000L)
+
+// Sets up the reply for anthywl_ipc::conversion and has Anthy segment it,
+// leaving the candidates to be listed.
+static bool anthywl_ipc_convert_start(struct anthywl_ipc *ipc) {
+    if (ipc->anthy_context == NULL) {
+        ipc->anthy_context = anthy_create_context();
+        if (ipc->anthy_context == NULL)
+            return false;
+        anthy_context_set_encoding(ipc->anthy_context, ANTHY_UTF8_ENCODING);
+        anthywl_buffer_init(&ipc->conversion_buffer);
+    }
+
+    // Feed the input through the buffer a character at a time, the same
+    // way typing it would.
+    struct anthywl_buffer *buffer = &ipc->conversion_buffer;
+    anthywl_buffer_clear(buffer);
+    char const *p = ipc->conversion->input;
+    while (*p != '\0') {
+        char c[5] = { *p++ };
+        for (size_t i = 1; i < 4 && (*p & 0xc0) == 0x80; i++)
+            c[i] = *p++;
+        anthywl_buffer_append(buffer, c);
+        anthywl_buffer_convert_romaji(buffer);
+    }
+    anthywl_buffer_convert_trailing_n(buffer);
+
+    if (varlink_object_new(&ipc->conversion_reply) < 0)
+        return false;
+    if (varlink_array_new(&ipc->conversion_segments) < 0)
+        return false;
+    varlink_object_set_string(ipc->conversion_reply, "kana", buffer->text);
+
+    anthy_reset_context(ipc->anthy_context);
+    struct anthy_conv_stat conv_stat = { 0 };
+    if (buffer->len != 0) {
+        ANTHYWL_TRACE_BEGIN("anthy_set_string");
+        anthy_set_string(ipc->anthy_context, buffer->text);
+        ANTHYWL_TRACE_END("anthy_set_string");
+        anthy_get_stat(ipc->anthy_context, &conv_stat);
+    }
+    ipc->conversion_segment = 0;
+    ipc->conversion_segments_len = conv_stat.nr_segment;
+    return true;
+}
+
+static void anthywl_ipc_convert_segment(struct anthywl_ipc *ipc, int i) {
+    struct anthy_segment_stat stat;
+    if (anthy_get_segment_stat(ipc->anthy_context, i, &stat) != 0)
+        return;
+    VarlinkObject *segment;
+    VarlinkArray *candidates;
+    varlink_object_new(&segment);
+    varlink_array_new(&candidates);
+    char buf[256];
+    if (anthy_get_segment(ipc->anthy_context,
+        i, NTH_UNCONVERTED_CANDIDATE, buf, sizeof buf) < 0)
+    {
+        buf[0] = '\0';
+    }
+    varlink_object_set_string(segment, "reading", buf);
+    int count = stat.nr_candidate;
+    int64_t max_candidates = ipc->conversion->max_candidates;
+    if (max_candidates > 0 && max_candidates < count)
+        count = max_candidates;
+    for (int j = 0; j < count; j++) {
+        if (anthy_get_segment(ipc->anthy_context, i, j, buf, sizeof buf) < 0)
+            buf[0] = '\0';
+        varlink_array_append_string(candidates, buf);
+    }
+    varlink_object_set_array(segment, "candidates", candidates);
+    varlink_array_unref(candidates);
+    varlink_array_append_object(ipc->conversion_segments, segment);
+    varlink_object_unref(segment);
+}
+
+// Drops anthywl_ipc::conversion without replying to it.
+static void anthywl_ipc_conversion_clear(struct anthywl_ipc *ipc) {
+    if (ipc->conversion_reply != NULL)
+        varlink_object_unref(ipc->conversion_reply);
+    if (ipc->conversion_segments != NULL)
+        varlink_array_unref(ipc->conversion_segments);
+    ipc->conversion_reply = NULL;
+    ipc->conversion_segments = NULL;
+    anthywl_ipc_command_destroy(ipc->conversion);
+    ipc->conversion = NULL;
+}
+
+// Converts a slice at a time, so key events that arrive during a long
+// conversion or a burst of Convert calls are handled in between: one main
+// loop iteration segments the input, the following ones list candidates
+// for as many segments as fit in CONVERT_SLICE_NS.
+static void anthywl_ipc_conversion_timer_callback(struct anthywl_timer *timer) {
+    struct anthywl_ipc *ipc = wl_container_of(timer, ipc, conversion_timer);
+    struct anthywl_state *state = wl_container_of(ipc, state, ipc);
+    uint64_t now = anthywl_timer_now();
+    if (ipc->conversion == NULL) {
+        while (ipc->conversion == NULL && !wl_list_empty(&ipc->conversions)) {
+            struct anthywl_ipc_command *conversion =
+                wl_container_of(ipc->conversions.prev, conversion, link);
+            wl_list_remove(&conversion->link);
+            if (now - conversion->queued <= CONVERT_WAIT_MAX_NS) {
+                ipc->conversion = conversion;
+            } else {
+                anthywl_ipc_send_reply(ipc, conversion->call,
+                    "ca.tadeo.anthywl.Busy", NULL, false);
+                anthywl_ipc_command_destroy(conversion);
+            }
+        }
+        if (ipc->conversion == NULL)
+            return;
+        if (!anthywl_ipc_convert_start(ipc)) {
+            anthywl_ipc_send_reply(ipc, ipc->conversion->call,
+                "ca.tadeo.anthywl.ConversionFailed", NULL, false);
+            anthywl_ipc_conversion_clear(ipc);
+        }
+    } else {
+        uint64_t deadline = now + CONVERT_SLICE_NS;
+        do {
+            anthywl_ipc_convert_segment(ipc, ipc->conversion_segment++);
+        } while (ipc->conversion_segment < ipc->conversion_segments_len
+            && anthywl_timer_now() < deadline);
+    }
+    if (ipc->conversion != NULL
+        && ipc->conversion_segment == ipc->conversion_segments_len)
+    {
+        varlink_object_set_array(ipc->conversion_reply,
+            "segments", ipc->conversion_segments);
+        anthywl_ipc_send_reply(ipc, ipc->conversion->call,
+            NULL, ipc->conversion_reply, false);
+        ipc->conversion_reply = NULL;
+        anthywl_ipc_conversion_clear(ipc);
+    }
+    if (ipc->conversion != NULL || !wl_list_empty(&ipc->conversions)) {
+        anthywl_timer_arm(&state->timers, &ipc->conversion_timer,
+            anthywl_timer_now());
+    }
+}
+
+static void anthywl_ipc_run_actions(struct anthywl_ipc *ipc,
+    struct anthywl_ipc_command *command)
+{
+    struct anthywl_state *state = wl_container_of(ipc, state, ipc);
+    struct anthywl_seat *seat = anthywl_ipc_find_seat(state, command->seat);
+    if (seat == NULL) {
+        anthywl_ipc_reply_no_such_seat(ipc, command->call, command->seat);
+        return;
+    }
+
+    VarlinkArray *handled = NULL;
+    if (!command->single)
+        varlink_array_new(&handled);
+    // The preedit and popup are only sent once, after the last action.
+    anthywl_composer_begin_batch(&seat->composer);
+    for (size_t i = 0; i < command->actions_len; i++) {
+        bool res = anthywl_composer_handle_action(
+            &seat->composer, command->actions[i]);
+        if (handled != NULL)
+            varlink_array_append_bool(handled, res);
+    }
+    anthywl_composer_end_batch(&seat->composer);
+
+    VarlinkObject *reply = NULL;
+    if (handled != NULL) {
+        if (varlink_object_new(&reply) >= 0)
+            varlink_object_set_array(reply, "handled", handled);
+        varlink_array_unref(handled);
+    }
+    anthywl_ipc_send_reply(ipc, command->call, NULL, reply, false);
+}
+
+static void anthywl_ipc_get_metrics(struct anthywl_ipc *ipc,
+    struct anthywl_ipc_command *command)
+{
+    VarlinkObject *reply;
+    VarlinkArray *stages, *counters;
+    varlink_object_new(&reply);
+    varlink_array_new(&stages);
+    varlink_array_new(&counters);
+    for (int i = 0; i < _ANTHYWL_STAGE_LAST; i++) {
+        struct anthywl_histogram const *histogram = &anthywl_metrics.stages[i];
+        VarlinkObject *stage;
+        varlink_object_new(&stage);
+        varlink_object_set_string(stage, "name", anthywl_stage_names[i]);
+        varlink_object_set_int(stage, "count", histogram->count);
+        varlink_object_set_float(stage, "mean", histogram->count != 0
+            ? (double)histogram->sum / histogram->count : 0.0);
+        varlink_object_set_int(stage, "p50",
+            anthywl_histogram_percentile(histogram, 50.0));
+        varlink_object_set_int(stage, "p90",
+            anthywl_histogram_percentile(histogram, 90.0));
+        varlink_object_set_int(stage, "p99",
+            anthywl_histogram_percentile(histogram, 99.0));
+        varlink_object_set_int(stage, "max", histogram->max);
+        varlink_array_append_object(stages, stage);
+        varlink_object_unref(stage);
+    }
+    VarlinkObject *counter;
+    for (int i = 0; i < _ANTHYWL_COUNTER_LAST; i++) {
+        varlink_object_new(&counter);
+        varlink_object_set_string(counter, "name", anthywl_counter_names[i]);
+        varlink_object_set_int(counter, "value", anthywl_metrics.counters[i]);
+        varlink_array_append_object(counters, counter);
+        varlink_object_unref(counter);
+    }
+    varlink_object_new(&counter);
+    varlink_object_set_string(counter, "name", "scratch-allocations");
+    varlink_object_set_int(counter, "value", anthywl_scratch_allocations);
+    varlink_array_append_object(counters, counter);
+    varlink_object_unref(counter);
+    varlink_object_set_array(reply, "stages", stages);
+    varlink_object_set_array(reply, "counters", counters);
+    varlink_array_unref(stages);
+    varlink_array_unref(counters);
+    anthywl_ipc_send_reply(ipc, command->call, NULL, reply, false);
+}
+
+static void anthywl_ipc_start_monitor(struct anthywl_ipc *ipc,
+    struct anthywl_ipc_command *command)
+{
+    struct anthywl_state *state = wl_container_of(ipc, state, ipc);
+    struct anthywl_seat *seat = anthywl_ipc_find_seat(state, command->seat);
+    if (seat == NULL) {
+        anthywl_ipc_reply_no_such_seat(ipc, command->call, command->seat);
+        return;
+    }
+
+    uint64_t hash;
+    VarlinkObject *reply = anthywl_ipc_state_reply(seat, &hash);
+    anthywl_ipc_send_reply(ipc, command->call, NULL, reply, command->more);
+    if (!command->more)
+        return;
+
+    struct anthywl_ipc_monitor *monitor = calloc(1, sizeof *monitor);
+    monitor->ipc = ipc;
+    monitor->seat = seat;
+    monitor->call = command->call;
+    monitor->timer.callback = anthywl_ipc_monitor_timer_callback;
+    monitor->last_sent = anthywl_timer_now();
+    monitor->last_hash = hash;
+    wl_list_insert(&ipc->monitors, &monitor->link);
+}
+
+static void anthywl_ipc_cancel(struct anthywl_ipc *ipc,
+    struct anthywl_ipc_call *call)
+{
+    // A call that was already answered has no monitor or conversion left,
+    // and the IPC thread has released it.
+    struct anthywl_ipc_monitor *monitor;
+    wl_list_for_each(monitor, &ipc->monitors, link) {
+        if (monitor->call == call) {
+            anthywl_ipc_monitor_destroy(monitor);
+            anthywl_ipc_send_reply(ipc, call, NULL, NULL, false);
+            return;
+        }
+    }
+    struct anthywl_ipc_command *conversion;
+    wl_list_for_each(conversion, &ipc->conversions, link) {
+        if (conversion->call == call) {
+            wl_list_remove(&conversion->link);
+            anthywl_ipc_command_destroy(conversion);
+            anthywl_ipc_send_reply(ipc, call, NULL, NULL, false);
+            return;
+        }
+    }
+    if (ipc->conversion != NULL && ipc->conversion->call == call) {
+        anthywl_ipc_conversion_clear(ipc);
+        anthywl_ipc_send_reply(ipc, call, NULL, NULL, false);
+    }
+}
+
+static void anthywl_ipc_handle_commands(struct anthywl_event_source *source,
+    uint32_t events)
+{
+    struct anthywl_ipc *ipc = wl_container_of(source, ipc, source);
+    struct anthywl_state *state = wl_container_of(ipc, state, ipc);
+    uint64_t count;
+    if (read(source->fd, &count, sizeof count) < 0)
+        perror("read");
+    if (atomic_load(&ipc->failed))
+        state->running = false;
+
+    struct anthywl_ipc_command *command;
+    while ((command = anthywl_queue_pop(&ipc->commands)) != NULL) {
+        switch (command->type) {
+        case ANTHYWL_IPC_COMMAND_ACTIONS:
+            anthywl_ipc_run_actions(ipc, command);
+            break;
+        case ANTHYWL_IPC_COMMAND_MONITOR:
+            anthywl_ipc_start_monitor(ipc, command);
+            break;
+        case ANTHYWL_IPC_COMMAND_CONVERT:
+            command->queued = anthywl_timer_now();
+            wl_list_insert(&ipc->conversions, &command->link);
+            if (!anthywl_timer_is_armed(&ipc->conversion_timer)) {
+                anthywl_timer_arm(&state->timers, &ipc->conversion_timer,
+                    anthywl_timer_now());
+            }
+            continue;
+        case ANTHYWL_IPC_COMMAND_GET_METRICS:
+            anthywl_ipc_get_metrics(ipc, command);
+            break;
+        case ANTHYWL_IPC_COMMAND_CANCELED:
+            anthywl_ipc_cancel(ipc, command->call);
+            break;
+        }
+        anthywl_ipc_command_destroy(command);
+    }
+}
+
+bool anthywl_ipc_init(struct anthywl_ipc *ipc,
+    struct anthywl_event_loop *event_loop)
+{
+    wl_list_init(&ipc->monitors);
+    wl_list_init(&ipc->conversions);
+    ipc->conversion_timer.callback = anthywl_ipc_conversion_timer_callback;
+    ipc->source.fd = -1;
+    ipc->thread_fd = -1;
+    atomic_init(&ipc->stop, false);
+    atomic_init(&ipc->failed, false);
     char ipc_addr[PATH_MAX];
     if (anthywl_ipc_addr(ipc_addr, sizeof ipc_addr) < 0)
         return false;
@@ -40,52 +810,110 @@ bool anthywl_ipc_init(struct anthywl_ipc *ipc) {
     res = varlink_service_add_interface(ipc->service,
         ca_tadeo_anthywl_interface,
         "Action", anthywl_ipc_handle_action, ipc,
+        "Actions", anthywl_ipc_handle_actions, ipc,
+        "Monitor", anthywl_ipc_handle_monitor, ipc,
+        "Convert", anthywl_ipc_handle_convert, ipc,
+        "GetMetrics", anthywl_ipc_handle_get_metrics, ipc,
         NULL);
     if (res < 0) {
         fprintf(stderr, "Failed to set up varlink service: %s\n",
             varlink_error_string(-res));
         return false;
     }
+
+    // Every call in flight has room for a command and a cancellation, or
+    // a final reply and the updates a monitor may send before it.
+    if (!anthywl_queue_init(&ipc->commands, 2 * ANTHYWL_IPC_CALLS_MAX)
+        || !anthywl_queue_init(&ipc->replies, 2 * ANTHYWL_IPC_CALLS_MAX))
+    {
+        perror("calloc");
+        return false;
+    }
+    ipc->source.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    ipc->thread_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (ipc->source.fd == -1 || ipc->thread_fd == -1) {
+        perror("eventfd");
+        return false;
+    }
+    ipc->event_loop = event_loop;
+    ipc->source.callback = anthywl_ipc_handle_commands;
+    if (!anthywl_event_loop_add(event_loop, &ipc->source, EPOLLIN))
+        return false;
+
+    // Signals are handled by the main thread's signalfd.
+    sigset_t mask, old_mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+    int err = pthread_create(&ipc->thread, NULL, anthywl_ipc_thread, ipc);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        return false;
+    }
+    ipc->thread_started = true;
     return true;
 }
 
 void anthywl_ipc_finish(struct anthywl_ipc *ipc) {
-    if (ipc->service != NULL)
-        varlink_service_free(ipc->service);
-}
-
-long anthywl_ipc_handle_action(VarlinkService *service, VarlinkCall *call,
-    VarlinkObject *parameters, uint64_t flags, void *userdata)
-{
-    long res;
-    char const *seat_name, *action_name;
-    struct anthywl_state *state = wl_container_of(userdata, state, ipc);
-    if ((res = varlink_object_get_string(parameters, "seat", &seat_name)) < 0)
-        return varlink_call_reply_invalid_parameter(call, "seat");
-    if ((res = varlink_object_get_string(parameters, "action", &action_name)) < 0)
-        return varlink_call_reply_invalid_parameter(call, "action");
-    enum anthywl_action action = anthywl_action_from_string(action_name);
-    if (action == ANTHYWL_ACTION_INVALID)
-        return varlink_call_reply_invalid_parameter(call, "action");
+    if (ipc->service == NULL)
+        return;
+    struct anthywl_state *state = wl_container_of(ipc, state, ipc);
+    if (ipc->thread_started) {
+        atomic_store(&ipc->stop, true);
+        anthywl_ipc_wake(ipc->thread_fd);
+        pthread_join(ipc->thread, NULL);
+    }
 
-    bool found = false;
-    struct anthywl_seat *seat;
-    wl_list_for_each(seat, &state->seats, link) {
-        if (strcmp(seat->name, seat_name) == 0) {
-            found = true;
-            break;
+    // With the IPC thread gone, release every call still in flight. Each
+    // one is in exactly one place: a queued command, a final reply, a
+    // monitor, or a queued conversion.
+    if (ipc->commands.items != NULL) {
+        struct anthywl_ipc_command *command;
+        while ((command = anthywl_queue_pop(&ipc->commands)) != NULL) {
+            if (command->type != ANTHYWL_IPC_COMMAND_CANCELED)
+                anthywl_ipc_call_release(command->call);
+            anthywl_ipc_command_destroy(command);
         }
+        anthywl_queue_finish(&ipc->commands);
     }
-    if (!found) {
-        VarlinkObject *no_such_seat;
-        if ((res = varlink_object_new(&no_such_seat)) < 0)
-            return res;
-        varlink_object_set_string(no_such_seat, "seat", seat_name);
-        return varlink_call_reply_error(
-            call, "ca.tadeo.anthywl.NoSuchSeat", no_such_seat);
+    if (ipc->replies.items != NULL) {
+        struct anthywl_ipc_reply *reply;
+        while ((reply = anthywl_queue_pop(&ipc->replies)) != NULL) {
+            if (!reply->continues)
+                anthywl_ipc_call_release(reply->call);
+            if (reply->parameters != NULL)
+                varlink_object_unref(reply->parameters);
+            free(reply);
+        }
+        anthywl_queue_finish(&ipc->replies);
+    }
+    struct anthywl_ipc_monitor *monitor, *tmp;
+    wl_list_for_each_safe(monitor, tmp, &ipc->monitors, link) {
+        anthywl_ipc_call_release(monitor->call);
+        anthywl_ipc_monitor_destroy(monitor);
+    }
+    struct anthywl_ipc_command *conversion, *tmp_conversion;
+    wl_list_for_each_safe(conversion, tmp_conversion, &ipc->conversions, link) {
+        anthywl_ipc_call_release(conversion->call);
+        wl_list_remove(&conversion->link);
+        anthywl_ipc_command_destroy(conversion);
+    }
+    if (ipc->conversion != NULL) {
+        anthywl_ipc_call_release(ipc->conversion->call);
+        anthywl_ipc_conversion_clear(ipc);
+    }
+    anthywl_timer_cancel(&state->timers, &ipc->conversion_timer);
+    if (ipc->anthy_context != NULL) {
+        anthy_release_context(ipc->anthy_context);
+        anthywl_buffer_destroy(&ipc->conversion_buffer);
     }
 
-    anthywl_seat_handle_action(seat, action);
-
-    return varlink_call_reply(call, NULL, 0);
+    if (ipc->source.fd != -1) {
+        if (ipc->event_loop != NULL)
+            anthywl_event_loop_remove(ipc->event_loop, &ipc->source);
+        close(ipc->source.fd);
+    }
+    if (ipc->thread_fd != -1)
+        close(ipc->thread_fd);
+    varlink_service_free(ipc->service);
 }
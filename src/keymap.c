@@ -1,40 +1,49 @@
 #include "keymap.h"
 
-#include <assert.h>
-#include <locale.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <wchar.h>
 
 #include <sys/mman.h>
 #include <unistd.h>
 
-#include <wayland-util.h>
 #include <xkbcommon/xkbcommon.h>
 
+static bool utf8_is_continuation(unsigned char c) {
+    return (c & 0xc0) == 0x80;
+}
+
 static unsigned char const *utf8_simple(unsigned char const *s, long *c) {
     unsigned char const *next;
     if (s[0] < 0x80) {
         *c = s[0];
         next = s + 1;
-    } else if ((s[0] & 0xe0) == 0xc0) {
+    } else if ((s[0] & 0xe0) == 0xc0
+        && utf8_is_continuation(s[1]))
+    {
         *c = ((long)(s[0] & 0x1f) <<  6) |
              ((long)(s[1] & 0x3f) <<  0);
         next = s + 2;
-    } else if ((s[0] & 0xf0) == 0xe0) {
+    } else if ((s[0] & 0xf0) == 0xe0
+        && utf8_is_continuation(s[1])
+        && utf8_is_continuation(s[2]))
+    {
         *c = ((long)(s[0] & 0x0f) << 12) |
              ((long)(s[1] & 0x3f) <<  6) |
              ((long)(s[2] & 0x3f) <<  0);
         next = s + 3;
-    } else if ((s[0] & 0xf8) == 0xf0 && (s[0] <= 0xf4)) {
+    } else if ((s[0] & 0xf8) == 0xf0 && (s[0] <= 0xf4)
+        && utf8_is_continuation(s[1])
+        && utf8_is_continuation(s[2])
+        && utf8_is_continuation(s[3]))
+    {
         *c = ((long)(s[0] & 0x07) << 18) |
              ((long)(s[1] & 0x3f) << 12) |
              ((long)(s[2] & 0x3f) <<  6) |
              ((long)(s[3] & 0x3f) <<  0);
         next = s + 4;
     } else {
-        *c = -1; // invalid
+        *c = -1; // invalid or truncated
         next = s + 1; // skip this byte
     }
     if (*c >= 0xd800 && *c <= 0xdfff)
@@ -42,54 +51,97 @@ static unsigned char const *utf8_simple(unsigned char const *s, long *c) {
     return next;
 }
 
-
-static int compare_keysym(void const *a, void const *b) {
-    return *(xkb_keysym_t *)a - *(xkb_keysym_t *)b;
+void anthywl_fallback_keymap_init(struct anthywl_fallback_keymap *keymap) {
+    memset(keymap, 0, sizeof *keymap);
 }
 
-bool anthywl_make_keymap(char const *string,
-    int *out_keymap_fd, size_t *out_keymap_size,
-    uint32_t **out_keys_seq, size_t *out_keys_size)
+// Position in the index where the keysym is, or would be inserted.
+static size_t anthywl_fallback_keymap_find(
+    struct anthywl_fallback_keymap *keymap, xkb_keysym_t keysym)
 {
-    struct wl_array keys;
-    wl_array_init(&keys);
+    size_t lo = 0, hi = keymap->len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (keymap->keysyms[keymap->index[mid]] < keysym)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
 
-    xkb_keysym_t keysyms[247] = {0};
-    size_t keysyms_len = 0;
+static void anthywl_fallback_keymap_insert(
+    struct anthywl_fallback_keymap *keymap, uint8_t slot, xkb_keysym_t keysym)
+{
+    size_t pos = anthywl_fallback_keymap_find(keymap, keysym);
+    memmove(&keymap->index[pos + 1], &keymap->index[pos],
+        keymap->len - pos);
+    keymap->index[pos] = slot;
+    keymap->keysyms[slot] = keysym;
+    keymap->len += 1;
+    keymap->dirty = true;
+}
 
-    {
-        unsigned char const *s = (unsigned char const *)string;
-        long c;
-        while (*s) {
-            s = utf8_simple(s, &c);
-            if (c < 0) continue;
-            xkb_keysym_t keysym = xkb_utf32_to_keysym((uint32_t)c);
-            uint32_t *found = bsearch(
-                &keysym, keysyms, keysyms_len, sizeof(uint32_t), compare_keysym);
-            if (!found) {
-                found = &keysyms[keysyms_len++];
-                *found = keysym;
-                qsort(keysyms, keysyms_len, sizeof(uint32_t), compare_keysym);
-            }
+static bool anthywl_fallback_keymap_lookup(
+    struct anthywl_fallback_keymap *keymap, xkb_keysym_t keysym,
+    uint32_t *out_key)
+{
+    size_t pos = anthywl_fallback_keymap_find(keymap, keysym);
+    uint8_t slot;
+    if (pos < keymap->len && keymap->keysyms[keymap->index[pos]] == keysym) {
+        slot = keymap->index[pos];
+    } else if (keymap->len < ANTHYWL_FALLBACK_KEYMAP_LEN) {
+        slot = keymap->len;
+        anthywl_fallback_keymap_insert(keymap, slot, keysym);
+    } else {
+        // Reuse the least recently used slot, unless the text being added
+        // already uses every slot.
+        slot = 0;
+        for (size_t i = 1; i < keymap->len; i++) {
+            if (keymap->last_used[i] < keymap->last_used[slot])
+                slot = i;
         }
+        if (keymap->last_used[slot] == keymap->generation)
+            return false;
+        size_t old_pos =
+            anthywl_fallback_keymap_find(keymap, keymap->keysyms[slot]);
+        memmove(&keymap->index[old_pos], &keymap->index[old_pos + 1],
+            keymap->len - old_pos - 1);
+        keymap->len -= 1;
+        anthywl_fallback_keymap_insert(keymap, slot, keysym);
     }
+    keymap->last_used[slot] = keymap->generation;
+    *out_key = slot + 2;
+    return true;
+}
 
-    {
-        unsigned char const *s = (unsigned char const *)string;
-        long c;
-        while (*s) {
-            s = utf8_simple(s, &c);
-            if (c < 0) continue;
+size_t anthywl_fallback_keymap_add_text(
+    struct anthywl_fallback_keymap *keymap,
+    char const *text, struct anthywl_array *keys)
+{
+    keymap->generation += 1;
+    keys->size = 0;
+    unsigned char const *s = (unsigned char const *)text;
+    long c;
+    while (*s) {
+        unsigned char const *next = utf8_simple(s, &c);
+        if (c >= 0) {
             xkb_keysym_t keysym = xkb_utf32_to_keysym((uint32_t)c);
-            uint32_t *found = bsearch(
-                &keysym, keysyms, keysyms_len, sizeof(uint32_t), compare_keysym);
-            assert(found);
-            uint32_t found_index = found - keysyms;
-            *(uint32_t *)wl_array_add(&keys, sizeof(uint32_t)) =
-                found_index + 2;
+            uint32_t key;
+            if (keysym != XKB_KEY_NoSymbol) {
+                if (!anthywl_fallback_keymap_lookup(keymap, keysym, &key))
+                    break;
+                *(uint32_t *)anthywl_array_add(keys, sizeof(uint32_t)) = key;
+            }
         }
+        s = next;
     }
+    return s - (unsigned char const *)text;
+}
 
+bool anthywl_fallback_keymap_write(struct anthywl_fallback_keymap *keymap,
+    int *out_keymap_fd, size_t *out_keymap_size)
+{
     int fd = memfd_create("anthywl-keymap", MFD_CLOEXEC);
     if (fd == -1) {
         perror("memfd_create");
@@ -107,7 +159,7 @@ bool anthywl_make_keymap(char const *string,
     fputs("\txkb_keycodes {\n", f);
     fputs("\t\tminimum = 8;\n", f);
     fputs("\t\tmaximum = 255;\n", f);
-    for (size_t i = 0; i < keysyms_len; i++) {
+    for (size_t i = 0; i < keymap->len; i++) {
         fprintf(f, "\t\t<C%zu> = %zu;\n", i + 2, i + 8 + 2);
     }
     fputs("\t};\n", f);
@@ -118,9 +170,9 @@ bool anthywl_make_keymap(char const *string,
     fputs("\t\tinterpret None { action = NoAction(); };\n", f);
     fputs("\t};\n", f);
     fputs("\txkb_symbols {\n", f);
-    for (size_t i = 0; i < keysyms_len; i++) {
+    for (size_t i = 0; i < keymap->len; i++) {
         char sym_name[256];
-        xkb_keysym_get_name(keysyms[i], sym_name, sizeof(sym_name));
+        xkb_keysym_get_name(keymap->keysyms[i], sym_name, sizeof(sym_name));
         fprintf(f, "\t\tkey <C%zu> { [ %s ] };\n", i + 2, sym_name);
     }
     fputs("\t};\n", f);
@@ -145,24 +197,11 @@ bool anthywl_make_keymap(char const *string,
     if (fclose(f) != 0) {
         perror("fclose");
         close(duplicated_fd);
-        close(fd);
         return false;
     }
 
-
-    struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-    char *map = mmap(NULL, keymap_size, PROT_READ, MAP_PRIVATE, duplicated_fd, 0);
-    assert(map);
-    struct xkb_keymap *keymap = xkb_keymap_new_from_string(
-        context, map, XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
-    munmap(map, keymap_size);
-    assert(keymap);
-
-
+    keymap->dirty = false;
     *out_keymap_fd = duplicated_fd;
     *out_keymap_size = keymap_size;
-    *out_keys_seq = keys.data;
-    *out_keys_size = keys.size / sizeof(uint32_t);
-
     return true;
 }
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "anthywl.h"
+
+// Keymaps no seat is using are kept around for a while, so switching back
+// and forth between layouts doesn't compile anything.
+#define UNUSED_KEYMAPS_MAX 4
+
+static uint64_t anthywl_keymap_hash(char const *string, size_t size) {
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)string[i];
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+void anthywl_keymap_rebuild_bindings(struct anthywl_keymap *keymap,
+    enum anthywl_config_change changes)
+{
+    struct anthywl_config *config = &keymap->state->config;
+    xkb_keycode_t max_keycode = xkb_keymap_max_keycode(keymap->xkb_keymap);
+    if (changes & ANTHYWL_CONFIG_GLOBAL_BINDINGS) {
+        anthywl_seat_bindings_set_up(&keymap->global_bindings,
+            &config->global_bindings, &keymap->keysym_keycodes,
+            keymap->mod_indices, max_keycode);
+    }
+    if (changes & ANTHYWL_CONFIG_SELECTING_BINDINGS) {
+        anthywl_seat_bindings_set_up(&keymap->selecting_bindings,
+            &config->selecting_bindings, &keymap->keysym_keycodes,
+            keymap->mod_indices, max_keycode);
+    }
+    if (changes & ANTHYWL_CONFIG_COMPOSING_BINDINGS) {
+        anthywl_seat_bindings_set_up(&keymap->composing_bindings,
+            &config->composing_bindings, &keymap->keysym_keycodes,
+            keymap->mod_indices, max_keycode);
+    }
+}
+
+static struct anthywl_keymap *anthywl_keymap_create(
+    struct anthywl_state *state, char const *string, size_t size,
+    uint64_t hash)
+{
+    struct xkb_keymap *xkb_keymap = xkb_keymap_new_from_buffer(
+        state->xkb_context, string, size,
+        XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+    if (xkb_keymap == NULL) {
+        fprintf(stderr, "Failed to compile keymap\n");
+        return NULL;
+    }
+
+    struct anthywl_keymap *keymap = calloc(1, sizeof *keymap);
+    keymap->state = state;
+    keymap->hash = hash;
+    keymap->string = malloc(size);
+    memcpy(keymap->string, string, size);
+    keymap->size = size;
+    keymap->xkb_keymap = xkb_keymap;
+    keymap->mod_indices[ANTHYWL_SHIFT_INDEX] = xkb_keymap_mod_get_index(
+        xkb_keymap, XKB_MOD_NAME_SHIFT);
+    keymap->mod_indices[ANTHYWL_CAPS_INDEX] = xkb_keymap_mod_get_index(
+        xkb_keymap, XKB_MOD_NAME_CAPS);
+    keymap->mod_indices[ANTHYWL_CTRL_INDEX] = xkb_keymap_mod_get_index(
+        xkb_keymap, XKB_MOD_NAME_CTRL);
+    keymap->mod_indices[ANTHYWL_ALT_INDEX] = xkb_keymap_mod_get_index(
+        xkb_keymap, XKB_MOD_NAME_ALT);
+    keymap->mod_indices[ANTHYWL_NUM_INDEX] = xkb_keymap_mod_get_index(
+        xkb_keymap, XKB_MOD_NAME_NUM);
+    keymap->mod_indices[ANTHYWL_MOD3_INDEX] = xkb_keymap_mod_get_index(
+        xkb_keymap, "Mod3");
+    keymap->mod_indices[ANTHYWL_LOGO_INDEX] = xkb_keymap_mod_get_index(
+        xkb_keymap, XKB_MOD_NAME_LOGO);
+    keymap->mod_indices[ANTHYWL_MOD5_INDEX] = xkb_keymap_mod_get_index(
+        xkb_keymap, "Mod5");
+    // Caps Lock and Num Lock don't affect which binding a key triggers.
+    keymap->binding_mods = ~(xkb_mod_mask_t)0;
+    if (keymap->mod_indices[ANTHYWL_CAPS_INDEX] != XKB_MOD_INVALID)
+        keymap->binding_mods &= ~(1 << keymap->mod_indices[ANTHYWL_CAPS_INDEX]);
+    if (keymap->mod_indices[ANTHYWL_NUM_INDEX] != XKB_MOD_INVALID)
+        keymap->binding_mods &= ~(1 << keymap->mod_indices[ANTHYWL_NUM_INDEX]);
+    anthywl_array_init(&keymap->keysym_keycodes);
+    anthywl_array_init(&keymap->global_bindings.bindings);
+    anthywl_array_init(&keymap->composing_bindings.bindings);
+    anthywl_array_init(&keymap->selecting_bindings.bindings);
+    anthywl_keysym_keycodes_index(&keymap->keysym_keycodes, xkb_keymap);
+    anthywl_keymap_rebuild_bindings(keymap, ANTHYWL_CONFIG_GLOBAL_BINDINGS
+        | ANTHYWL_CONFIG_SELECTING_BINDINGS
+        | ANTHYWL_CONFIG_COMPOSING_BINDINGS);
+    return keymap;
+}
+
+struct anthywl_keymap *anthywl_keymap_get(struct anthywl_state *state,
+    char const *string, size_t size)
+{
+    uint64_t hash = anthywl_keymap_hash(string, size);
+    struct anthywl_keymap *keymap;
+    wl_list_for_each(keymap, &state->keymaps, link) {
+        if (keymap->hash == hash && keymap->size == size
+            && memcmp(keymap->string, string, size) == 0)
+        {
+            wl_list_remove(&keymap->link);
+            goto found;
+        }
+    }
+    keymap = anthywl_keymap_create(state, string, size, hash);
+    if (keymap == NULL)
+        return NULL;
+found:
+    wl_list_insert(&state->keymaps, &keymap->link);
+    keymap->refcount += 1;
+    return keymap;
+}
+
+void anthywl_keymap_unref(struct anthywl_keymap *keymap) {
+    if (keymap == NULL || --keymap->refcount > 0)
+        return;
+    // The list is in most recently used order, so this drops the unused
+    // keymaps that were used longest ago.
+    int unused = 0;
+    struct anthywl_keymap *iter, *tmp;
+    wl_list_for_each_safe(iter, tmp, &keymap->state->keymaps, link) {
+        if (iter->refcount == 0 && ++unused > UNUSED_KEYMAPS_MAX)
+            anthywl_keymap_destroy(iter);
+    }
+}
+
+void anthywl_keymap_destroy(struct anthywl_keymap *keymap) {
+    wl_list_remove(&keymap->link);
+    anthywl_seat_bindings_finish(&keymap->global_bindings);
+    anthywl_seat_bindings_finish(&keymap->composing_bindings);
+    anthywl_seat_bindings_finish(&keymap->selecting_bindings);
+    anthywl_array_release(&keymap->keysym_keycodes);
+    xkb_keymap_unref(keymap->xkb_keymap);
+    free(keymap->string);
+    free(keymap);
+}
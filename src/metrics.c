@@ -0,0 +1,101 @@
+#include "metrics.h"
+
+#include "arena.h"
+#include "timer.h"
+
+struct anthywl_metrics anthywl_metrics;
+
+char const *const anthywl_stage_names[_ANTHYWL_STAGE_LAST] = {
+    [ANTHYWL_STAGE_BINDING_LOOKUP] = "binding-lookup",
+    [ANTHYWL_STAGE_ROMAJI] = "romaji",
+    [ANTHYWL_STAGE_ANTHY] = "anthy",
+    [ANTHYWL_STAGE_POPUP_LAYOUT] = "popup-layout",
+    [ANTHYWL_STAGE_POPUP_RASTER] = "popup-raster",
+    [ANTHYWL_STAGE_SHM_BUFFER] = "shm-buffer",
+    [ANTHYWL_STAGE_KEY_TO_PREEDIT] = "key-to-preedit",
+    [ANTHYWL_STAGE_KEY_TO_COMMIT] = "key-to-commit",
+};
+
+char const *const anthywl_counter_names[_ANTHYWL_COUNTER_LAST] = {
+    [ANTHYWL_COUNTER_KEYS] = "keys",
+    [ANTHYWL_COUNTER_PREEDITS] = "preedits",
+    [ANTHYWL_COUNTER_COMMITS] = "commits",
+    [ANTHYWL_COUNTER_POPUP_DRAWS] = "popup-draws",
+    [ANTHYWL_COUNTER_BUFFERS_CREATED] = "buffers-created",
+};
+
+static unsigned anthywl_histogram_index(uint64_t value) {
+    if (value < 8)
+        return value;
+    unsigned exponent = 63 - __builtin_clzll(value);
+    unsigned index = (exponent - 2) * 8 + ((value >> (exponent - 3)) & 7);
+    if (index >= ANTHYWL_HISTOGRAM_BUCKETS)
+        return ANTHYWL_HISTOGRAM_BUCKETS - 1;
+    return index;
+}
+
+static uint64_t anthywl_histogram_bucket_max(unsigned index) {
+    if (index < 8)
+        return index;
+    unsigned exponent = index / 8 + 2;
+    return ((uint64_t)(8 + index % 8 + 1) << (exponent - 3)) - 1;
+}
+
+void anthywl_histogram_add(struct anthywl_histogram *histogram,
+    uint64_t value)
+{
+    histogram->count += 1;
+    histogram->sum += value;
+    if (value > histogram->max)
+        histogram->max = value;
+    histogram->buckets[anthywl_histogram_index(value)] += 1;
+}
+
+uint64_t anthywl_histogram_percentile(
+    struct anthywl_histogram const *histogram, double percentile)
+{
+    if (histogram->count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(histogram->count * percentile / 100.0);
+    if (rank >= histogram->count)
+        rank = histogram->count - 1;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < ANTHYWL_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > rank) {
+            uint64_t value = anthywl_histogram_bucket_max(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+void anthywl_metrics_record(enum anthywl_stage stage, uint64_t start) {
+    anthywl_histogram_add(
+        &anthywl_metrics.stages[stage], anthywl_timer_now() - start);
+}
+
+void anthywl_metrics_dump(FILE *f) {
+    fprintf(f, "%-20s %10s %10s %10s %10s %10s %10s\n",
+        "stage (us)", "count", "mean", "p50", "p90", "p99", "max");
+    for (int i = 0; i < _ANTHYWL_STAGE_LAST; i++) {
+        struct anthywl_histogram const *histogram = &anthywl_metrics.stages[i];
+        double mean = histogram->count != 0
+            ? (double)histogram->sum / histogram->count : 0.0;
+        fprintf(f, "%-20s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            anthywl_stage_names[i],
+            (unsigned long long)histogram->count,
+            mean / 1000.0,
+            anthywl_histogram_percentile(histogram, 50.0) / 1000.0,
+            anthywl_histogram_percentile(histogram, 90.0) / 1000.0,
+            anthywl_histogram_percentile(histogram, 99.0) / 1000.0,
+            histogram->max / 1000.0);
+    }
+    for (int i = 0; i < _ANTHYWL_COUNTER_LAST; i++) {
+        fprintf(f, "%-20s %10llu\n", anthywl_counter_names[i],
+            (unsigned long long)anthywl_metrics.counters[i]);
+    }
+    fprintf(f, "%-20s %10llu\n", "scratch-allocations",
+        (unsigned long long)anthywl_scratch_allocations);
+    fflush(f);
+}
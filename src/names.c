@@ -0,0 +1,42 @@
+#include "names.h"
+#include "actions.h"
+
+#include <string.h>
+
+#include "action_names.inc"
+
+#define ARRAY_LEN(x) (sizeof (x) / sizeof *(x))
+
+uint32_t anthywl_name_hash(char const *name, uint32_t seed) {
+    uint32_t hash = UINT32_C(2166136261) ^ seed;
+    for (; *name != '\0'; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= UINT32_C(16777619);
+    }
+    return hash;
+}
+
+int anthywl_name_lookup(struct anthywl_name const *table, size_t table_len,
+    uint32_t seed, char const *name)
+{
+    // Table sizes are powers of two.
+    struct anthywl_name const *entry =
+        &table[anthywl_name_hash(name, seed) & (table_len - 1)];
+    if (entry->name == NULL || strcmp(entry->name, name) != 0)
+        return 0;
+    return entry->value;
+}
+
+enum anthywl_action anthywl_action_from_string(const char *name) {
+    return ANTHYWL_NAME_LOOKUP(anthywl_action_names, name);
+}
+
+char const *anthywl_action_to_string(enum anthywl_action action) {
+    if (action <= ANTHYWL_ACTION_INVALID
+        || (size_t)action >= ARRAY_LEN(anthywl_action_names_by_value)
+        || anthywl_action_names_by_value[action] == NULL)
+    {
+        return "invalid";
+    }
+    return anthywl_action_names_by_value[action];
+}
@@ -0,0 +1,42 @@
+#include "queue.h"
+
+#include <stdlib.h>
+
+bool anthywl_queue_init(struct anthywl_queue *queue, size_t cap) {
+    queue->items = calloc(cap, sizeof *queue->items);
+    if (queue->items == NULL)
+        return false;
+    queue->cap = cap;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    return true;
+}
+
+void anthywl_queue_finish(struct anthywl_queue *queue) {
+    free(queue->items);
+}
+
+bool anthywl_queue_push(struct anthywl_queue *queue, void *item) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail - head == queue->cap)
+        return false;
+    queue->items[tail & (queue->cap - 1)] = item;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+void *anthywl_queue_pop(struct anthywl_queue *queue) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head == tail)
+        return NULL;
+    void *item = queue->items[head & (queue->cap - 1)];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return item;
+}
+
+size_t anthywl_queue_len(struct anthywl_queue *queue) {
+    return atomic_load_explicit(&queue->tail, memory_order_acquire)
+        - atomic_load_explicit(&queue->head, memory_order_acquire);
+}
@@ -0,0 +1,290 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "anthywl.h"
+#include "record.h"
+
+#define RECORD_MAGIC "anthywlR"
+#define RECORD_VERSION 2
+// Recordings come from anywhere, so lengths are checked before trusting
+// them. Keymaps are the largest payloads by far.
+#define RECORD_LEN_MAX (16 * 1024 * 1024)
+#define RECORD_SEATS_MAX 64
+
+// How many 32-bit fields each type of record starts with.
+static size_t const record_fields[_ANTHYWL_RECORD_LAST] = {
+    [ANTHYWL_RECORD_KEYMAP] = 1,
+    [ANTHYWL_RECORD_KEY] = 3,
+    [ANTHYWL_RECORD_MODIFIERS] = 4,
+    [ANTHYWL_RECORD_REPEAT_INFO] = 2,
+    [ANTHYWL_RECORD_ACTIVATE] = 0,
+    [ANTHYWL_RECORD_DEACTIVATE] = 0,
+    [ANTHYWL_RECORD_SURROUNDING_TEXT] = 2,
+    [ANTHYWL_RECORD_TEXT_CHANGE_CAUSE] = 1,
+    [ANTHYWL_RECORD_CONTENT_TYPE] = 2,
+    [ANTHYWL_RECORD_DONE] = 0,
+};
+
+bool anthywl_recorder_open(struct anthywl_recorder *recorder,
+    char const *path)
+{
+    recorder->file = fopen(path, "wb");
+    if (recorder->file == NULL) {
+        perror("fopen");
+        return false;
+    }
+    uint32_t version = RECORD_VERSION;
+    if (fwrite(RECORD_MAGIC, strlen(RECORD_MAGIC), 1, recorder->file) != 1
+        || fwrite(&version, sizeof version, 1, recorder->file) != 1)
+    {
+        perror("fwrite");
+        fclose(recorder->file);
+        recorder->file = NULL;
+        return false;
+    }
+    recorder->start = anthywl_timer_now();
+    return true;
+}
+
+void anthywl_recorder_close(struct anthywl_recorder *recorder) {
+    if (recorder->file == NULL)
+        return;
+    if (fclose(recorder->file) != 0)
+        perror("fclose");
+    recorder->file = NULL;
+}
+
+void anthywl_recorder_write(struct anthywl_recorder *recorder,
+    uint32_t seat, enum anthywl_record_type type,
+    uint32_t const *fields, size_t fields_len,
+    char const *text, size_t text_len)
+{
+    if (recorder->file == NULL)
+        return;
+    uint64_t time = anthywl_timer_now() - recorder->start;
+    uint8_t type_byte = type;
+    uint32_t len = fields_len * sizeof *fields + text_len;
+    // Writes are buffered by stdio; a failed one stops the recording rather
+    // than leaving a file that can't be read back.
+    if (fwrite(&time, sizeof time, 1, recorder->file) != 1
+        || fwrite(&type_byte, sizeof type_byte, 1, recorder->file) != 1
+        || fwrite(&seat, sizeof seat, 1, recorder->file) != 1
+        || fwrite(&len, sizeof len, 1, recorder->file) != 1
+        || (fields_len != 0 && fwrite(fields,
+            sizeof *fields, fields_len, recorder->file) != fields_len)
+        || (text_len != 0
+            && fwrite(text, text_len, 1, recorder->file) != 1))
+    {
+        perror("Failed to write recording");
+        anthywl_recorder_close(recorder);
+    }
+}
+
+static void anthywl_replay_keymap(struct anthywl_seat *seat,
+    uint32_t format, char const *text, size_t text_len)
+{
+    int fd = memfd_create("anthywl-keymap", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("memfd_create");
+        return;
+    }
+    // Compositors send the keymap with its terminating NUL.
+    if (write(fd, text, text_len + 1) != (ssize_t)(text_len + 1)) {
+        perror("write");
+        close(fd);
+        return;
+    }
+    zwp_input_method_keyboard_grab_v2_keymap(
+        seat, NULL, format, fd, text_len + 1);
+}
+
+static void anthywl_replay_dispatch(struct anthywl_seat *seat,
+    enum anthywl_record_type type, uint32_t const *fields,
+    char const *text, size_t text_len)
+{
+    // Key events are meaningless before the first keymap, which a
+    // compositor always sends first.
+    if ((type == ANTHYWL_RECORD_KEY || type == ANTHYWL_RECORD_MODIFIERS)
+        && seat->keymap == NULL)
+    {
+        return;
+    }
+    switch (type) {
+    case ANTHYWL_RECORD_KEYMAP:
+        anthywl_replay_keymap(seat, fields[0], text, text_len);
+        break;
+    case ANTHYWL_RECORD_KEY:
+        zwp_input_method_keyboard_grab_v2_key(
+            seat, NULL, 0, fields[0], fields[1], fields[2]);
+        break;
+    case ANTHYWL_RECORD_MODIFIERS:
+        zwp_input_method_keyboard_grab_v2_modifiers(
+            seat, NULL, 0, fields[0], fields[1], fields[2], fields[3]);
+        break;
+    case ANTHYWL_RECORD_REPEAT_INFO:
+        zwp_input_method_keyboard_grab_v2_repeat_info(
+            seat, NULL, (int32_t)fields[0], (int32_t)fields[1]);
+        break;
+    case ANTHYWL_RECORD_ACTIVATE:
+        zwp_input_method_v2_activate(seat, NULL);
+        break;
+    case ANTHYWL_RECORD_DEACTIVATE:
+        zwp_input_method_v2_deactivate(seat, NULL);
+        break;
+    case ANTHYWL_RECORD_SURROUNDING_TEXT:
+        zwp_input_method_v2_surrounding_text(
+            seat, NULL, text, fields[0], fields[1]);
+        break;
+    case ANTHYWL_RECORD_TEXT_CHANGE_CAUSE:
+        zwp_input_method_v2_text_change_cause(seat, NULL, fields[0]);
+        break;
+    case ANTHYWL_RECORD_CONTENT_TYPE:
+        zwp_input_method_v2_content_type(seat, NULL, fields[0], fields[1]);
+        break;
+    case ANTHYWL_RECORD_DONE:
+        zwp_input_method_v2_done(seat, NULL);
+        break;
+    case _ANTHYWL_RECORD_LAST:
+        break;
+    }
+}
+
+// Seats are created as their first event is read back, each with requests
+// going nowhere.
+static struct anthywl_seat *anthywl_replay_seat(struct anthywl_state *state,
+    struct anthywl_seat **seats, uint32_t index)
+{
+    if (seats[index] != NULL)
+        return seats[index];
+    struct anthywl_seat *seat = calloc(1, sizeof *seat);
+    if (seat == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    anthywl_seat_init(seat, state, NULL);
+    seat->composer.sink = &anthywl_null_sink;
+    char name[32];
+    snprintf(name, sizeof name, "replay-%" PRIu32, index);
+    seat->name = strdup(name);
+    wl_list_insert(&state->seats, &seat->link);
+    return seats[index] = seat;
+}
+
+// Runs the event loop until the deadline, so key repeat and other timers
+// fire as they did while recording.
+static bool anthywl_replay_wait(struct anthywl_state *state,
+    uint64_t deadline)
+{
+    uint64_t now;
+    while ((now = anthywl_timer_now()) < deadline) {
+        int timeout = (deadline - now + 999999) / 1000000;
+        if (anthywl_event_loop_dispatch(&state->event_loop, timeout) == -1)
+            return false;
+    }
+    return true;
+}
+
+// Feeds a recording through the same handlers the compositor's events go
+// to, for seats whose requests go nowhere. Without realtime, events are
+// handled as fast as possible and timers, like key repeat, never fire.
+bool anthywl_replay(struct anthywl_state *state, char const *path,
+    bool realtime)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror("fopen");
+        return false;
+    }
+    char magic[sizeof RECORD_MAGIC - 1];
+    uint32_t version;
+    if (fread(magic, sizeof magic, 1, file) != 1
+        || memcmp(magic, RECORD_MAGIC, sizeof magic) != 0
+        || fread(&version, sizeof version, 1, file) != 1
+        || version != RECORD_VERSION)
+    {
+        fprintf(stderr, "%s is not a recording anthywl can replay\n", path);
+        fclose(file);
+        return false;
+    }
+
+    struct anthywl_seat *seats[RECORD_SEATS_MAX] = {0};
+    bool ok = true;
+    size_t events = 0;
+    char *payload = NULL;
+    size_t payload_cap = 0;
+    uint64_t time;
+    state->running = true;
+    uint64_t start = anthywl_timer_now();
+    while (state->running && fread(&time, sizeof time, 1, file) == 1) {
+        uint8_t type;
+        uint32_t seat_index;
+        uint32_t len;
+        if (fread(&type, sizeof type, 1, file) != 1
+            || fread(&seat_index, sizeof seat_index, 1, file) != 1
+            || fread(&len, sizeof len, 1, file) != 1
+            || type >= _ANTHYWL_RECORD_LAST
+            || seat_index >= RECORD_SEATS_MAX
+            || len < record_fields[type] * sizeof(uint32_t)
+            || len > RECORD_LEN_MAX)
+        {
+            fprintf(stderr, "%s: malformed record\n", path);
+            ok = false;
+            break;
+        }
+        // Text in the payload is read back NUL-terminated.
+        if ((size_t)len + 1 > payload_cap) {
+            payload_cap = (size_t)len + 1;
+            free(payload);
+            payload = malloc(payload_cap);
+            if (payload == NULL) {
+                perror("malloc");
+                ok = false;
+                break;
+            }
+        }
+        if (len != 0 && fread(payload, len, 1, file) != 1) {
+            fprintf(stderr, "%s: truncated record\n", path);
+            ok = false;
+            break;
+        }
+        payload[len] = '\0';
+
+        struct anthywl_seat *seat =
+            anthywl_replay_seat(state, seats, seat_index);
+        if (seat == NULL) {
+            ok = false;
+            break;
+        }
+        uint32_t fields[4];
+        size_t fields_size = record_fields[type] * sizeof(uint32_t);
+        memcpy(fields, payload, fields_size);
+
+        if (realtime && !anthywl_replay_wait(state, start + time)) {
+            ok = false;
+            break;
+        }
+        anthywl_state_begin_batch(state);
+        anthywl_replay_dispatch(seat, type, fields,
+            payload + fields_size, len - fields_size);
+        anthywl_state_end_batch(state);
+        events++;
+    }
+    if (ok && ferror(file)) {
+        perror("fread");
+        ok = false;
+    }
+    uint64_t elapsed = anthywl_timer_now() - start;
+    state->running = false;
+    free(payload);
+    fclose(file);
+
+    fprintf(stderr, "Replayed %zu events in %.3f ms\n",
+        events, elapsed / 1e6);
+    anthywl_metrics_dump(stderr);
+    return ok;
+}
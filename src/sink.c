@@ -0,0 +1,201 @@
+#include <wayland-client.h>
+
+#include "input-method-unstable-v2-client-protocol.h"
+#include "virtual-keyboard-unstable-v1-client-protocol.h"
+
+#include "anthywl.h"
+#include "graphics_buffer.h"
+#include "sink.h"
+
+static struct anthywl_seat *seat_from_composer(
+    struct anthywl_composer *composer)
+{
+    struct anthywl_seat *seat = wl_container_of(composer, seat, composer);
+    return seat;
+}
+
+static void wayland_set_preedit_string(struct anthywl_composer *composer,
+    char const *text, int32_t cursor_begin, int32_t cursor_end)
+{
+    zwp_input_method_v2_set_preedit_string(
+        seat_from_composer(composer)->zwp_input_method_v2,
+        text, cursor_begin, cursor_end);
+}
+
+static void wayland_commit_string(struct anthywl_composer *composer,
+    char const *text)
+{
+    zwp_input_method_v2_commit_string(
+        seat_from_composer(composer)->zwp_input_method_v2, text);
+}
+
+static void wayland_delete_surrounding_text(struct anthywl_composer *composer,
+    uint32_t before_length, uint32_t after_length)
+{
+    zwp_input_method_v2_delete_surrounding_text(
+        seat_from_composer(composer)->zwp_input_method_v2,
+        before_length, after_length);
+}
+
+static void wayland_commit(struct anthywl_composer *composer) {
+    struct anthywl_seat *seat = seat_from_composer(composer);
+    zwp_input_method_v2_commit(
+        seat->zwp_input_method_v2, seat->done_events_received);
+}
+
+// Typing, drawing the popup and telling IPC monitors work the same whether
+// or not there is a compositor; only the requests they end in differ.
+static bool seat_type_string(struct anthywl_composer *composer,
+    char const *text)
+{
+    return anthywl_seat_type_string(seat_from_composer(composer), text);
+}
+
+static void seat_update_popup(struct anthywl_composer *composer) {
+    anthywl_seat_draw_popup(seat_from_composer(composer));
+}
+
+static void seat_changed(struct anthywl_composer *composer) {
+#ifdef ANTHYWL_IPC_SUPPORT
+    struct anthywl_seat *seat = seat_from_composer(composer);
+    anthywl_ipc_seat_changed(&seat->state->ipc, seat);
+#endif
+}
+
+static void wayland_show_popup(struct anthywl_seat *seat,
+    struct anthywl_graphics_buffer *buffer, int scale)
+{
+    if (buffer != NULL) {
+        wl_surface_attach(seat->wl_surface, buffer->wl_buffer, 0, 0);
+        wl_surface_damage_buffer(seat->wl_surface, 0, 0,
+            buffer->width, buffer->height);
+        wl_surface_set_buffer_scale(seat->wl_surface, scale);
+    } else {
+        wl_surface_attach(seat->wl_surface, NULL, 0, 0);
+    }
+    wl_surface_commit(seat->wl_surface);
+}
+
+static void wayland_forward_keymap(struct anthywl_seat *seat,
+    uint32_t format, int32_t fd, uint32_t size)
+{
+    zwp_virtual_keyboard_v1_keymap(
+        seat->zwp_virtual_keyboard_v1_passthrough, format, fd, size);
+}
+
+static void wayland_forward_key(struct anthywl_seat *seat,
+    uint32_t time, uint32_t key, uint32_t state)
+{
+    zwp_virtual_keyboard_v1_key(
+        seat->zwp_virtual_keyboard_v1_passthrough, time, key, state);
+}
+
+static void wayland_forward_modifiers(struct anthywl_seat *seat,
+    uint32_t mods_depressed, uint32_t mods_latched, uint32_t mods_locked,
+    uint32_t group)
+{
+    zwp_virtual_keyboard_v1_modifiers(seat->zwp_virtual_keyboard_v1_passthrough,
+        mods_depressed, mods_latched, mods_locked, group);
+}
+
+static void wayland_type_keymap(struct anthywl_seat *seat,
+    uint32_t format, int32_t fd, uint32_t size)
+{
+    zwp_virtual_keyboard_v1_keymap(
+        seat->zwp_virtual_keyboard_v1_backup_input, format, fd, size);
+}
+
+static void wayland_type_key(struct anthywl_seat *seat,
+    uint32_t key, uint32_t state)
+{
+    zwp_virtual_keyboard_v1_key(
+        seat->zwp_virtual_keyboard_v1_backup_input, 0, key, state);
+}
+
+static void wayland_flush(struct anthywl_seat *seat) {
+    wl_display_flush(seat->state->wl_display);
+}
+
+struct anthywl_sink const anthywl_wayland_sink = {
+    .set_preedit_string = wayland_set_preedit_string,
+    .commit_string = wayland_commit_string,
+    .delete_surrounding_text = wayland_delete_surrounding_text,
+    .commit = wayland_commit,
+    .type_string = seat_type_string,
+    .update_popup = seat_update_popup,
+    .changed = seat_changed,
+    .show_popup = wayland_show_popup,
+    .forward_keymap = wayland_forward_keymap,
+    .forward_key = wayland_forward_key,
+    .forward_modifiers = wayland_forward_modifiers,
+    .type_keymap = wayland_type_keymap,
+    .type_key = wayland_type_key,
+    .flush = wayland_flush,
+};
+
+static void null_set_preedit_string(struct anthywl_composer *composer,
+    char const *text, int32_t cursor_begin, int32_t cursor_end)
+{
+}
+
+static void null_commit_string(struct anthywl_composer *composer,
+    char const *text)
+{
+}
+
+static void null_delete_surrounding_text(struct anthywl_composer *composer,
+    uint32_t before_length, uint32_t after_length)
+{
+}
+
+static void null_commit(struct anthywl_composer *composer) {
+}
+
+static void null_show_popup(struct anthywl_seat *seat,
+    struct anthywl_graphics_buffer *buffer, int scale)
+{
+    // There's no compositor to release it.
+    if (buffer != NULL)
+        buffer->in_use = false;
+}
+
+static void null_keymap(struct anthywl_seat *seat,
+    uint32_t format, int32_t fd, uint32_t size)
+{
+}
+
+static void null_forward_key(struct anthywl_seat *seat,
+    uint32_t time, uint32_t key, uint32_t state)
+{
+}
+
+static void null_forward_modifiers(struct anthywl_seat *seat,
+    uint32_t mods_depressed, uint32_t mods_latched, uint32_t mods_locked,
+    uint32_t group)
+{
+}
+
+static void null_type_key(struct anthywl_seat *seat,
+    uint32_t key, uint32_t state)
+{
+}
+
+static void null_flush(struct anthywl_seat *seat) {
+}
+
+struct anthywl_sink const anthywl_null_sink = {
+    .set_preedit_string = null_set_preedit_string,
+    .commit_string = null_commit_string,
+    .delete_surrounding_text = null_delete_surrounding_text,
+    .commit = null_commit,
+    .type_string = seat_type_string,
+    .update_popup = seat_update_popup,
+    .changed = seat_changed,
+    .show_popup = null_show_popup,
+    .forward_keymap = null_keymap,
+    .forward_key = null_forward_key,
+    .forward_modifiers = null_forward_modifiers,
+    .type_keymap = null_keymap,
+    .type_key = null_type_key,
+    .flush = null_flush,
+};
@@ -0,0 +1,171 @@
+#include "timer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+uint64_t anthywl_timer_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void anthywl_timer_queue_swap(struct anthywl_timer_queue *queue,
+    size_t a, size_t b)
+{
+    struct anthywl_timer *tmp = queue->heap[a];
+    queue->heap[a] = queue->heap[b];
+    queue->heap[b] = tmp;
+    queue->heap[a]->index = a + 1;
+    queue->heap[b]->index = b + 1;
+}
+
+static void anthywl_timer_queue_sift_up(struct anthywl_timer_queue *queue,
+    size_t i)
+{
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (queue->heap[parent]->deadline <= queue->heap[i]->deadline)
+            break;
+        anthywl_timer_queue_swap(queue, i, parent);
+        i = parent;
+    }
+}
+
+static void anthywl_timer_queue_sift_down(struct anthywl_timer_queue *queue,
+    size_t i)
+{
+    for (;;) {
+        size_t left = i * 2 + 1, right = left + 1, smallest = i;
+        if (left < queue->len
+            && queue->heap[left]->deadline < queue->heap[smallest]->deadline)
+        {
+            smallest = left;
+        }
+        if (right < queue->len
+            && queue->heap[right]->deadline < queue->heap[smallest]->deadline)
+        {
+            smallest = right;
+        }
+        if (smallest == i)
+            break;
+        anthywl_timer_queue_swap(queue, i, smallest);
+        i = smallest;
+    }
+}
+
+static void anthywl_timer_queue_update_fd(struct anthywl_timer_queue *queue) {
+    uint64_t deadline = queue->len != 0 ? queue->heap[0]->deadline : 0;
+    if (deadline == queue->armed_deadline)
+        return;
+    // An all-zero it_value disarms the timerfd.
+    struct itimerspec spec = {
+        .it_value = {
+            .tv_sec = deadline / 1000000000,
+            .tv_nsec = deadline % 1000000000,
+        },
+    };
+    if (timerfd_settime(queue->fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+        perror("timerfd_settime");
+        return;
+    }
+    queue->armed_deadline = deadline;
+}
+
+static void anthywl_timer_queue_remove(struct anthywl_timer_queue *queue,
+    struct anthywl_timer *timer)
+{
+    size_t i = timer->index - 1;
+    queue->len -= 1;
+    if (i != queue->len) {
+        anthywl_timer_queue_swap(queue, i, queue->len);
+        anthywl_timer_queue_sift_up(queue, i);
+        anthywl_timer_queue_sift_down(queue, i);
+    }
+    timer->index = 0;
+}
+
+bool anthywl_timer_queue_init(struct anthywl_timer_queue *queue) {
+    queue->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (queue->fd == -1) {
+        perror("timerfd_create");
+        return false;
+    }
+    queue->heap = NULL;
+    queue->len = 0;
+    queue->cap = 0;
+    queue->armed_deadline = 0;
+    return true;
+}
+
+void anthywl_timer_queue_finish(struct anthywl_timer_queue *queue) {
+    for (size_t i = 0; i < queue->len; i++)
+        queue->heap[i]->index = 0;
+    free(queue->heap);
+    if (queue->fd != -1)
+        close(queue->fd);
+}
+
+void anthywl_timer_queue_dispatch(struct anthywl_timer_queue *queue) {
+    uint64_t expirations;
+    ssize_t rc = read(queue->fd, &expirations, sizeof expirations);
+    // Nothing to read means the timerfd was rearmed after epoll reported
+    // it. Deadlines are checked against the clock either way.
+    if (rc == -1 && errno != EAGAIN && errno != EINTR)
+        perror("read");
+    else if (rc != -1 && rc != sizeof expirations)
+        fprintf(stderr, "Short read from timerfd\n");
+    uint64_t now = anthywl_timer_now();
+    while (queue->len != 0 && queue->heap[0]->deadline <= now) {
+        struct anthywl_timer *timer = queue->heap[0];
+        anthywl_timer_queue_remove(queue, timer);
+        timer->callback(timer);
+    }
+    // The timerfd has fired, so it must be rearmed even for an unchanged
+    // deadline.
+    queue->armed_deadline = 0;
+    anthywl_timer_queue_update_fd(queue);
+}
+
+void anthywl_timer_arm(struct anthywl_timer_queue *queue,
+    struct anthywl_timer *timer, uint64_t deadline)
+{
+    timer->deadline = deadline;
+    if (timer->index != 0) {
+        anthywl_timer_queue_sift_up(queue, timer->index - 1);
+        anthywl_timer_queue_sift_down(queue, timer->index - 1);
+    } else {
+        if (queue->len == queue->cap) {
+            size_t cap = queue->cap != 0 ? queue->cap * 2 : 8;
+            struct anthywl_timer **heap =
+                realloc(queue->heap, cap * sizeof *heap);
+            if (heap == NULL) {
+                perror("realloc");
+                abort();
+            }
+            queue->heap = heap;
+            queue->cap = cap;
+        }
+        queue->heap[queue->len] = timer;
+        timer->index = ++queue->len;
+        anthywl_timer_queue_sift_up(queue, queue->len - 1);
+    }
+    anthywl_timer_queue_update_fd(queue);
+}
+
+void anthywl_timer_cancel(struct anthywl_timer_queue *queue,
+    struct anthywl_timer *timer)
+{
+    if (timer->index == 0)
+        return;
+    anthywl_timer_queue_remove(queue, timer);
+    anthywl_timer_queue_update_fd(queue);
+}
+
+bool anthywl_timer_is_armed(struct anthywl_timer const *timer) {
+    return timer->index != 0;
+}
@@ -0,0 +1,186 @@
+#include "trace.h"
+#include "timer.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Events each thread can have waiting for the writer. When a ring is full,
+// new events are dropped rather than making the thread wait. Begin and end
+// events are dropped in pairs so the trace stays balanced.
+#define TRACE_RING_LEN 4096
+#define TRACE_FLUSH_INTERVAL_NS (100 * 1000000L)
+
+struct anthywl_trace_record {
+    uint64_t time;
+    char const *name;
+    char phase;
+};
+
+// Written by its thread, read by the writer thread.
+struct anthywl_trace_ring {
+    struct anthywl_trace_ring *next;
+    long tid;
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    atomic_size_t dropped;
+    // Only used by the ring's thread: end events owed to accepted begins,
+    // which always have room kept for them, and how deep into dropped
+    // begins the thread is.
+    size_t open;
+    size_t skip_depth;
+    struct anthywl_trace_record records[TRACE_RING_LEN];
+};
+
+atomic_bool anthywl_trace_enabled;
+
+static _Atomic(struct anthywl_trace_ring *) anthywl_trace_rings;
+static _Thread_local struct anthywl_trace_ring *anthywl_trace_ring;
+static FILE *anthywl_trace_file;
+static bool anthywl_trace_first_record;
+static pthread_t anthywl_trace_thread;
+static atomic_bool anthywl_trace_stopping;
+
+static struct anthywl_trace_ring *anthywl_trace_ring_create(void) {
+    struct anthywl_trace_ring *ring = calloc(1, sizeof *ring);
+    if (ring == NULL)
+        return NULL;
+    ring->tid = syscall(SYS_gettid);
+    ring->next = atomic_load(&anthywl_trace_rings);
+    while (!atomic_compare_exchange_weak(
+        &anthywl_trace_rings, &ring->next, ring))
+    {
+    }
+    return ring;
+}
+
+void anthywl_trace_event(char const *name, char phase) {
+    struct anthywl_trace_ring *ring = anthywl_trace_ring;
+    if (ring == NULL) {
+        ring = anthywl_trace_ring = anthywl_trace_ring_create();
+        if (ring == NULL)
+            return;
+    }
+    if (ring->skip_depth != 0) {
+        if (phase == 'B')
+            ring->skip_depth++;
+        else
+            ring->skip_depth--;
+        return;
+    }
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (phase == 'B') {
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail - head + ring->open + 2 > TRACE_RING_LEN) {
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            ring->skip_depth = 1;
+            return;
+        }
+        ring->open++;
+    } else if (ring->open == 0) {
+        // Its begin came before tracing started.
+        return;
+    } else {
+        ring->open--;
+    }
+    ring->records[tail % TRACE_RING_LEN] = (struct anthywl_trace_record){
+        .time = anthywl_timer_now(),
+        .name = name,
+        .phase = phase,
+    };
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static void anthywl_trace_flush(void) {
+    pid_t pid = getpid();
+    struct anthywl_trace_ring *ring = atomic_load(&anthywl_trace_rings);
+    for (; ring != NULL; ring = ring->next) {
+        size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        for (; head != tail; head++) {
+            struct anthywl_trace_record *record =
+                &ring->records[head % TRACE_RING_LEN];
+            fprintf(anthywl_trace_file,
+                "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,"
+                "\"pid\":%d,\"tid\":%ld}",
+                anthywl_trace_first_record ? "" : ",\n",
+                record->name, record->phase,
+                (unsigned long long)(record->time / 1000),
+                (unsigned)(record->time % 1000), (int)pid, ring->tid);
+            anthywl_trace_first_record = false;
+        }
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+    }
+    fflush(anthywl_trace_file);
+}
+
+static void *anthywl_trace_writer(void *data) {
+    struct timespec interval = { .tv_nsec = TRACE_FLUSH_INTERVAL_NS };
+    while (!atomic_load(&anthywl_trace_stopping)) {
+        nanosleep(&interval, NULL);
+        anthywl_trace_flush();
+    }
+    return NULL;
+}
+
+bool anthywl_trace_start(char const *path) {
+    anthywl_trace_file = fopen(path, "w");
+    if (anthywl_trace_file == NULL) {
+        fprintf(stderr, "Failed to open trace file %s: %s\n",
+            path, strerror(errno));
+        return false;
+    }
+    fputs("[\n", anthywl_trace_file);
+    anthywl_trace_first_record = true;
+
+    // Signals are handled by the main thread's signalfd.
+    sigset_t mask, old_mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+    int err = pthread_create(
+        &anthywl_trace_thread, NULL, anthywl_trace_writer, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        fclose(anthywl_trace_file);
+        anthywl_trace_file = NULL;
+        return false;
+    }
+    atomic_store(&anthywl_trace_enabled, true);
+    return true;
+}
+
+// Only called once every other thread that traced has finished.
+void anthywl_trace_stop(void) {
+    if (anthywl_trace_file == NULL)
+        return;
+    atomic_store(&anthywl_trace_enabled, false);
+    atomic_store(&anthywl_trace_stopping, true);
+    pthread_join(anthywl_trace_thread, NULL);
+    anthywl_trace_flush();
+    fputs("\n]\n", anthywl_trace_file);
+    fclose(anthywl_trace_file);
+    anthywl_trace_file = NULL;
+
+    struct anthywl_trace_ring *ring = atomic_load(&anthywl_trace_rings);
+    while (ring != NULL) {
+        struct anthywl_trace_ring *next = ring->next;
+        size_t dropped = atomic_load(&ring->dropped);
+        if (dropped != 0) {
+            fprintf(stderr, "Dropped %zu trace event pairs on thread %ld\n",
+                dropped, ring->tid);
+        }
+        free(ring);
+        ring = next;
+    }
+    atomic_store(&anthywl_trace_rings, NULL);
+}
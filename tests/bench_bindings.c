@@ -0,0 +1,69 @@
+#include <stdlib.h>
+
+#include "bindings.h"
+#include "test.h"
+
+#define LOOKUPS 10000000
+#define MIN_KEYCODE 8
+#define MAX_KEYCODE 255
+
+static xkb_mod_index_t const mod_indices[_ANTHYWL_MOD_LAST] = {
+    0, 1, 2, 3, 4, 5, 6, 7,
+};
+
+int main(void) {
+    // A keymap with a keysym on every key, and bindings for a quarter of
+    // them with a few modifier combinations each, like a large config.
+    struct anthywl_array keysym_keycodes, bindings;
+    anthywl_array_init(&keysym_keycodes);
+    anthywl_array_init(&bindings);
+    for (xkb_keycode_t keycode = MIN_KEYCODE; keycode <= MAX_KEYCODE;
+        keycode++)
+    {
+        struct anthywl_keysym_keycode *key = anthywl_array_add(
+            &keysym_keycodes, sizeof *key);
+        key->keysym = 0x1000 + keycode;
+        key->keycode = keycode;
+        if (keycode % 4 != 0)
+            continue;
+        enum anthywl_modifier const modifiers[] = {
+            0, ANTHYWL_SHIFT, ANTHYWL_CTRL, ANTHYWL_CTRL | ANTHYWL_SHIFT,
+        };
+        for (size_t i = 0; i < sizeof modifiers / sizeof *modifiers; i++) {
+            struct anthywl_binding *binding = anthywl_array_add(
+                &bindings, sizeof *binding);
+            binding->keysym = key->keysym;
+            binding->modifiers = modifiers[i];
+            binding->action = ANTHYWL_ACTION_ENABLE + i;
+        }
+    }
+    qsort(bindings.data, bindings.size / sizeof(struct anthywl_binding),
+        sizeof(struct anthywl_binding), anthywl_binding_compare);
+
+    struct anthywl_seat_bindings seat_bindings = {0};
+    anthywl_seat_bindings_set_up(&seat_bindings, &bindings, &keysym_keycodes,
+        mod_indices, MAX_KEYCODE);
+
+    // Most keys typed have no binding, and some have modifiers held.
+    uint32_t random = 1;
+    uint64_t found = 0;
+    uint64_t start = anthywl_timer_now();
+    for (int i = 0; i < LOOKUPS; i++) {
+        random = random * 1103515245 + 12345;
+        xkb_keycode_t keycode =
+            MIN_KEYCODE + (random >> 8) % (MAX_KEYCODE - MIN_KEYCODE + 1);
+        xkb_mod_mask_t mod_mask = (random >> 24) & 0x5;
+        if (anthywl_seat_bindings_find(&seat_bindings, keycode, mod_mask)
+            != ANTHYWL_ACTION_INVALID)
+        {
+            found++;
+        }
+    }
+    bench_report("binding lookups", LOOKUPS, start);
+    CHECK(found != 0 && found != LOOKUPS);
+
+    anthywl_seat_bindings_finish(&seat_bindings);
+    anthywl_array_release(&bindings);
+    anthywl_array_release(&keysym_keycodes);
+    return TEST_STATUS();
+}
@@ -0,0 +1,91 @@
+#include <anthy/anthy.h>
+#include <stdio.h>
+
+#include "actions.h"
+#include "composer.h"
+#include "test.h"
+
+#define CONVERSIONS 2000
+
+// Meson counts a test exiting with this as skipped.
+#define EXIT_SKIP 77
+
+static void bench_set_preedit_string(struct anthywl_composer *composer,
+    char const *text, int32_t cursor_begin, int32_t cursor_end)
+{
+}
+
+static void bench_commit_string(struct anthywl_composer *composer,
+    char const *text)
+{
+}
+
+static void bench_delete_surrounding_text(struct anthywl_composer *composer,
+    uint32_t before_length, uint32_t after_length)
+{
+}
+
+static void bench_commit(struct anthywl_composer *composer) {
+}
+
+static bool bench_type_string(struct anthywl_composer *composer,
+    char const *text)
+{
+    return true;
+}
+
+static void bench_update_popup(struct anthywl_composer *composer) {
+}
+
+static void bench_changed(struct anthywl_composer *composer) {
+}
+
+// Only what a composer sends; there's no seat to show a popup for.
+static struct anthywl_sink const bench_sink = {
+    .set_preedit_string = bench_set_preedit_string,
+    .commit_string = bench_commit_string,
+    .delete_surrounding_text = bench_delete_surrounding_text,
+    .commit = bench_commit,
+    .type_string = bench_type_string,
+    .update_popup = bench_update_popup,
+    .changed = bench_changed,
+};
+
+static char const *const sentences[] = {
+    "きょうはいいてんきですね",
+    "あしたはあめがふるそうです",
+    "にほんごのべんきょうをしています",
+    "かさをわすれないでください",
+};
+
+int main(void) {
+    if (anthy_init() != 0) {
+        perror("anthy_init");
+        return EXIT_SKIP;
+    }
+
+    struct anthywl_composer composer = {0};
+    anthywl_composer_init(&composer, &bench_sink);
+    composer.active = true;
+    composer.is_composing = true;
+
+    uint64_t segments = 0;
+    uint64_t start = anthywl_timer_now();
+    for (int i = 0; i < CONVERSIONS; i++) {
+        // As for a key, updates are batched and flushed once at the end.
+        anthywl_composer_begin_batch(&composer);
+        anthywl_buffer_append(&composer.buffer,
+            sentences[i % (sizeof sentences / sizeof *sentences)]);
+        anthywl_composer_handle_action(&composer, ANTHYWL_ACTION_SELECT);
+        segments += composer.segment_count;
+        anthywl_composer_handle_action(&composer, ANTHYWL_ACTION_ACCEPT);
+        anthywl_composer_end_batch(&composer);
+    }
+    bench_report("conversions", CONVERSIONS, start);
+    CHECK(segments >= CONVERSIONS);
+    CHECK(composer.buffer.len == 0 && !composer.is_selecting);
+
+    anthywl_composer_finish(&composer);
+    anthy_quit();
+    return TEST_STATUS();
+}
@@ -0,0 +1,28 @@
+#include "buffer.h"
+#include "test.h"
+
+#define ROUNDS 20000
+
+static char const text[] =
+    "kyouhaiitenkidesune.ashitahaamegafurusoudesukara,kasawowasurenaide"
+    "kudasai.konnnichiha,nihongonobenkyouwoshiteimasu.";
+
+int main(void) {
+    struct anthywl_buffer buffer;
+    anthywl_buffer_init(&buffer);
+    uint64_t keys = 0;
+    uint64_t start = anthywl_timer_now();
+    for (int i = 0; i < ROUNDS; i++) {
+        // A preedit is committed at the end of each sentence or so.
+        anthywl_buffer_clear(&buffer);
+        for (char const *c = text; *c != '\0'; c++) {
+            anthywl_buffer_append(&buffer, (char[]){*c, '\0'});
+            anthywl_buffer_convert_romaji(&buffer);
+            keys++;
+        }
+    }
+    bench_report("keystrokes", keys, start);
+    CHECK(buffer.len != 0);
+    anthywl_buffer_destroy(&buffer);
+    return TEST_STATUS();
+}
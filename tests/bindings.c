@@ -0,0 +1,106 @@
+#include <stdlib.h>
+
+#include "bindings.h"
+#include "test.h"
+
+#define ARRAY_LEN(x) (sizeof (x) / sizeof *(x))
+
+// Modifier indices as a keymap might number them, deliberately not in the
+// order of enum anthywl_modifier_index.
+static xkb_mod_index_t const mod_indices[_ANTHYWL_MOD_LAST] = {
+    [ANTHYWL_SHIFT_INDEX] = 0,
+    [ANTHYWL_CAPS_INDEX] = 1,
+    [ANTHYWL_CTRL_INDEX] = 2,
+    [ANTHYWL_ALT_INDEX] = 3,
+    [ANTHYWL_NUM_INDEX] = 4,
+    [ANTHYWL_MOD3_INDEX] = 5,
+    [ANTHYWL_LOGO_INDEX] = 7,
+    [ANTHYWL_MOD5_INDEX] = 6,
+};
+
+// Sorted by keysym, as anthywl_keysym_keycodes_index leaves them. Space is
+// on two keys.
+static struct anthywl_keysym_keycode const keys[] = {
+    { XKB_KEY_space, 65 },
+    { XKB_KEY_space, 200 },
+    { XKB_KEY_BackSpace, 22 },
+    { XKB_KEY_Return, 36 },
+    { XKB_KEY_Left, 113 },
+    { XKB_KEY_Right, 114 },
+};
+
+static struct anthywl_binding const config_bindings[] = {
+    { XKB_KEY_space, 0, ANTHYWL_ACTION_SELECT },
+    { XKB_KEY_Return, 0, ANTHYWL_ACTION_ACCEPT },
+    { XKB_KEY_BackSpace, ANTHYWL_CTRL | ANTHYWL_SHIFT,
+        ANTHYWL_ACTION_TOGGLE },
+    { XKB_KEY_Left, 0, ANTHYWL_ACTION_MOVE_LEFT },
+    { XKB_KEY_Left, ANTHYWL_SHIFT, ANTHYWL_ACTION_EXPAND_LEFT },
+    { XKB_KEY_Left, ANTHYWL_LOGO, ANTHYWL_ACTION_PREV_CANDIDATE },
+};
+
+int main(void) {
+    struct anthywl_array keysym_keycodes, bindings;
+    anthywl_array_init(&keysym_keycodes);
+    anthywl_array_init(&bindings);
+    for (size_t i = 0; i < ARRAY_LEN(keys); i++) {
+        *(struct anthywl_keysym_keycode *)anthywl_array_add(
+            &keysym_keycodes, sizeof keys[i]) = keys[i];
+    }
+    for (size_t i = 0; i < ARRAY_LEN(config_bindings); i++) {
+        *(struct anthywl_binding *)anthywl_array_add(
+            &bindings, sizeof config_bindings[i]) = config_bindings[i];
+    }
+    qsort(bindings.data, ARRAY_LEN(config_bindings),
+        sizeof(struct anthywl_binding), anthywl_binding_compare);
+
+    struct anthywl_seat_bindings seat_bindings = {0};
+    anthywl_seat_bindings_set_up(
+        &seat_bindings, &bindings, &keysym_keycodes, mod_indices, 255);
+
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 65, 0)
+        == ANTHYWL_ACTION_SELECT);
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 200, 0)
+        == ANTHYWL_ACTION_SELECT);
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 36, 0)
+        == ANTHYWL_ACTION_ACCEPT);
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 22, 1 << 0 | 1 << 2)
+        == ANTHYWL_ACTION_TOGGLE);
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 113, 0)
+        == ANTHYWL_ACTION_MOVE_LEFT);
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 113, 1 << 0)
+        == ANTHYWL_ACTION_EXPAND_LEFT);
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 113, 1 << 7)
+        == ANTHYWL_ACTION_PREV_CANDIDATE);
+
+    // Modifiers must match exactly.
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 22, 1 << 2)
+        == ANTHYWL_ACTION_INVALID);
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 36, 1 << 0)
+        == ANTHYWL_ACTION_INVALID);
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 113, 1 << 6)
+        == ANTHYWL_ACTION_INVALID);
+    // Keys without bindings, or outside the keymap.
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 114, 0)
+        == ANTHYWL_ACTION_INVALID);
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 0, 0)
+        == ANTHYWL_ACTION_INVALID);
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 256, 0)
+        == ANTHYWL_ACTION_INVALID);
+
+    // Setting up again, as for a new keymap, replaces the old bindings.
+    keysym_keycodes.size = sizeof keys[0];
+    anthywl_seat_bindings_set_up(
+        &seat_bindings, &bindings, &keysym_keycodes, mod_indices, 100);
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 65, 0)
+        == ANTHYWL_ACTION_SELECT);
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 36, 0)
+        == ANTHYWL_ACTION_INVALID);
+    CHECK(anthywl_seat_bindings_find(&seat_bindings, 200, 0)
+        == ANTHYWL_ACTION_INVALID);
+
+    anthywl_seat_bindings_finish(&seat_bindings);
+    anthywl_array_release(&bindings);
+    anthywl_array_release(&keysym_keycodes);
+    return TEST_STATUS();
+}
@@ -0,0 +1,151 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bindings.h"
+#include "config.h"
+#include "test.h"
+
+// Purposes and hints from text-input-unstable-v3.
+#define PURPOSE_NORMAL 0
+#define PURPOSE_DIGITS 2
+#define PURPOSE_EMAIL 6
+#define PURPOSE_PASSWORD 8
+#define PURPOSE_TERMINAL 13
+#define HINT_HIDDEN_TEXT 0x40
+#define HINT_LATIN 0x100
+
+static char config_dir[PATH_MAX], config_path[PATH_MAX];
+
+static bool write_config(char const *text) {
+    FILE *f = fopen(config_path, "w");
+    if (f == NULL) {
+        perror("failed to write config");
+        return false;
+    }
+    fputs(text, f);
+    fclose(f);
+    return true;
+}
+
+static size_t bindings_len(struct anthywl_array const *bindings) {
+    return bindings->size / sizeof(struct anthywl_binding);
+}
+
+static void check_default_config(void) {
+    struct anthywl_config config = {0};
+    anthywl_config_init(&config);
+    CHECK(anthywl_config_load(&config));
+    CHECK(config.active_at_startup);
+    CHECK(config.monitor_interval_ms == 50);
+    CHECK(bindings_len(&config.global_bindings) == 1);
+    CHECK(bindings_len(&config.composing_bindings) != 0);
+    CHECK(bindings_len(&config.selecting_bindings) != 0);
+    CHECK(anthywl_config_input_mode(&config, 0, PURPOSE_PASSWORD)
+        == ANTHYWL_INPUT_MODE_PASSTHROUGH);
+    CHECK(anthywl_config_input_mode(&config, HINT_HIDDEN_TEXT, PURPOSE_NORMAL)
+        == ANTHYWL_INPUT_MODE_PASSTHROUGH);
+    CHECK(anthywl_config_input_mode(&config, 0, PURPOSE_DIGITS)
+        == ANTHYWL_INPUT_MODE_LATIN);
+    CHECK(anthywl_config_input_mode(&config, 0, PURPOSE_NORMAL)
+        == ANTHYWL_INPUT_MODE_DEFAULT);
+    anthywl_config_finish(&config);
+}
+
+static void check_config_file(void) {
+    if (!write_config(
+        "monitor-interval 20\n"
+        "content-type {\n"
+        "    terminal latin\n"
+        "    latin hiragana\n"
+        "    email katakana\n"
+        "    no-such-purpose latin\n"
+        "}\n"
+        "composing-bindings {\n"
+        "    Ctrl+space select\n"
+        "    NoSuchKey accept\n"
+        "}\n"))
+    {
+        test_failures++;
+        return;
+    }
+
+    struct anthywl_config config = {0};
+    anthywl_config_init(&config);
+    CHECK(anthywl_config_load(&config));
+    CHECK(!config.active_at_startup);
+    CHECK(config.monitor_interval_ms == 20);
+    CHECK(bindings_len(&config.global_bindings) == 0);
+    CHECK(bindings_len(&config.composing_bindings) == 1);
+    if (bindings_len(&config.composing_bindings) == 1) {
+        struct anthywl_binding *binding = config.composing_bindings.data;
+        CHECK(binding->keysym == XKB_KEY_space);
+        CHECK(binding->modifiers == ANTHYWL_CTRL);
+        CHECK(binding->action == ANTHYWL_ACTION_SELECT);
+    }
+
+    // Rules apply in file order, and a purpose matches exactly.
+    CHECK(config.content_type_rules.size
+        == 3 * sizeof(struct anthywl_content_type_rule));
+    CHECK(anthywl_config_input_mode(&config, HINT_LATIN, PURPOSE_TERMINAL)
+        == ANTHYWL_INPUT_MODE_LATIN);
+    CHECK(anthywl_config_input_mode(&config, HINT_LATIN, PURPOSE_EMAIL)
+        == ANTHYWL_INPUT_MODE_HIRAGANA);
+    CHECK(anthywl_config_input_mode(&config, 0, PURPOSE_EMAIL)
+        == ANTHYWL_INPUT_MODE_KATAKANA);
+    CHECK(anthywl_config_input_mode(&config, 0, PURPOSE_PASSWORD)
+        == ANTHYWL_INPUT_MODE_DEFAULT);
+
+    // Reloading reports which bindings changed.
+    enum anthywl_config_change changes;
+    if (write_config(
+        "global-bindings {\n"
+        "    Ctrl+Shift+Backspace toggle\n"
+        "}\n"
+        "composing-bindings {\n"
+        "    Ctrl+space select\n"
+        "}\n"))
+    {
+        CHECK(anthywl_config_reload(&config, &changes));
+        CHECK(changes == (ANTHYWL_CONFIG_GLOBAL_BINDINGS
+            | ANTHYWL_CONFIG_CONTENT_TYPE_RULES));
+        CHECK(config.monitor_interval_ms == 50);
+        CHECK(anthywl_config_input_mode(&config, 0, PURPOSE_EMAIL)
+            == ANTHYWL_INPUT_MODE_DEFAULT);
+    }
+    // A file that doesn't parse leaves the config as it was.
+    if (write_config("global-bindings {\n")) {
+        CHECK(!anthywl_config_reload(&config, &changes));
+        CHECK(bindings_len(&config.global_bindings) == 1);
+    }
+    anthywl_config_finish(&config);
+}
+
+int main(void) {
+    char dir_template[] = "/tmp/anthywl-test-XXXXXX";
+    char const *dir = mkdtemp(dir_template);
+    if (dir == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(config_dir, sizeof config_dir, "%s/anthywl", dir);
+    snprintf(config_path, sizeof config_path, "%s/anthywl/config", dir);
+    setenv("XDG_CONFIG_HOME", dir, 1);
+
+    // Without a file, the built-in default config is used.
+    check_default_config();
+
+    if (mkdir(config_dir, 0700) == 0) {
+        check_config_file();
+        unlink(config_path);
+        rmdir(config_dir);
+    } else {
+        perror("mkdir");
+        test_failures++;
+    }
+    rmdir(dir);
+    return TEST_STATUS();
+}
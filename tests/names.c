@@ -0,0 +1,57 @@
+#include <string.h>
+
+#include "actions.h"
+#include "bindings.h"
+#include "names.h"
+#include "test.h"
+
+#include "action_names.inc"
+#include "modifier_names.inc"
+
+#define ARRAY_LEN(x) (sizeof (x) / sizeof *(x))
+
+// Every name in a table must be found in its own slot.
+static void check_table(struct anthywl_name const *table, size_t table_len,
+    uint32_t seed)
+{
+    for (size_t i = 0; i < table_len; i++) {
+        if (table[i].name == NULL)
+            continue;
+        int value = anthywl_name_lookup(table, table_len, seed, table[i].name);
+        if (value != table[i].value) {
+            fprintf(stderr, "%s: got %d, expected %d\n",
+                table[i].name, value, table[i].value);
+            test_failures++;
+        }
+    }
+}
+
+int main(void) {
+    check_table(anthywl_action_names, ARRAY_LEN(anthywl_action_names),
+        anthywl_action_names_seed);
+    check_table(anthywl_modifier_names, ARRAY_LEN(anthywl_modifier_names),
+        anthywl_modifier_names_seed);
+
+    for (enum anthywl_action action = ANTHYWL_ACTION_INVALID + 1;
+        action < _ANTHYWL_ACTION_LAST; action++)
+    {
+        char const *name = anthywl_action_to_string(action);
+        CHECK(strcmp(name, "invalid") != 0);
+        CHECK(anthywl_action_from_string(name) == action);
+    }
+    CHECK(strcmp(anthywl_action_to_string(ANTHYWL_ACTION_INVALID),
+        "invalid") == 0);
+    CHECK(strcmp(anthywl_action_to_string(_ANTHYWL_ACTION_LAST),
+        "invalid") == 0);
+    CHECK(anthywl_action_from_string("") == ANTHYWL_ACTION_INVALID);
+    CHECK(anthywl_action_from_string("Select") == ANTHYWL_ACTION_INVALID);
+    CHECK(anthywl_action_from_string("select-") == ANTHYWL_ACTION_INVALID);
+
+    CHECK(ANTHYWL_NAME_LOOKUP(anthywl_modifier_names, "Ctrl") == ANTHYWL_CTRL);
+    CHECK(ANTHYWL_NAME_LOOKUP(anthywl_modifier_names, "Control")
+        == ANTHYWL_CTRL);
+    CHECK(ANTHYWL_NAME_LOOKUP(anthywl_modifier_names, "Mod4") == ANTHYWL_LOGO);
+    CHECK(ANTHYWL_NAME_LOOKUP(anthywl_modifier_names, "Hyper") == 0);
+
+    return TEST_STATUS();
+}
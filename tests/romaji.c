@@ -0,0 +1,68 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "test.h"
+
+// Types the input a character at a time, as the key handler does.
+static void type(struct anthywl_buffer *buffer, char const *input,
+    bool katakana)
+{
+    for (; *input != '\0'; input++) {
+        anthywl_buffer_append(buffer, (char[]){*input, '\0'});
+        anthywl_buffer_convert_romaji(buffer);
+        if (katakana)
+            anthywl_buffer_convert_katakana(buffer);
+    }
+}
+
+static void check_romaji(char const *input, bool katakana,
+    char const *expected)
+{
+    struct anthywl_buffer buffer;
+    anthywl_buffer_init(&buffer);
+    type(&buffer, input, katakana);
+    anthywl_buffer_convert_trailing_n(&buffer);
+    if (strcmp(buffer.text, expected) != 0) {
+        fprintf(stderr, "%s: got %s, expected %s\n",
+            input, buffer.text, expected);
+        test_failures++;
+    }
+    CHECK(buffer.len == strlen(expected));
+    CHECK(buffer.pos == buffer.len);
+    anthywl_buffer_destroy(&buffer);
+}
+
+int main(void) {
+    check_romaji("ka", false, "か");
+    check_romaji("kyo", false, "きょ");
+    check_romaji("kka", false, "っか");
+    check_romaji("tsu", false, "つ");
+    check_romaji("chi", false, "ち");
+    check_romaji("fa", false, "ふぁ");
+    check_romaji("nihongo", false, "にほんご");
+    check_romaji("konnnichiha", false, "こんにちは");
+    check_romaji("n'a", false, "んあ");
+    check_romaji("shinbun", false, "しんぶん");
+    check_romaji("a.", false, "あ。");
+    check_romaji("-", false, "ー");
+    check_romaji("katakana", true, "カタカナ");
+
+    // Editing in the middle leaves the rest alone.
+    struct anthywl_buffer buffer;
+    anthywl_buffer_init(&buffer);
+    type(&buffer, "kaki", false);
+    anthywl_buffer_move_left(&buffer);
+    CHECK(buffer.pos == strlen("か"));
+    type(&buffer, "ku", false);
+    CHECK(strcmp(buffer.text, "かくき") == 0);
+    anthywl_buffer_delete_backwards(&buffer, 1);
+    CHECK(strcmp(buffer.text, "かき") == 0);
+    anthywl_buffer_delete_forwards(&buffer, 1);
+    CHECK(strcmp(buffer.text, "か") == 0);
+    anthywl_buffer_clear(&buffer);
+    CHECK(buffer.len == 0 && buffer.pos == 0);
+    anthywl_buffer_destroy(&buffer);
+
+    return TEST_STATUS();
+}
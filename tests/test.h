@@ -0,0 +1,32 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "timer.h"
+
+// Unlike assert, checks aren't compiled out by -Db_ndebug, and a failing
+// one doesn't stop the rest from running.
+static int test_failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", \
+            __FILE__, __LINE__, #cond); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define TEST_STATUS() (test_failures == 0 ? 0 : 1)
+
+// Prints how many of something were done per second since start, a
+// timestamp from anthywl_timer_now.
+static inline void bench_report(char const *what, uint64_t count,
+    uint64_t start)
+{
+    uint64_t elapsed = anthywl_timer_now() - start;
+    if (elapsed == 0)
+        elapsed = 1;
+    printf("%.0f %s/s (%" PRIu64 " in %.3fs)\n",
+        (double)count * 1e9 / elapsed, what, count, elapsed / 1e9);
+}